@@ -0,0 +1,137 @@
+// Benchmark reporting, shared by the C++ loop finders.
+//
+// The programs time each iteration of their workload and hand the
+// times to BenchReport, which prints the minimum, median, 99th
+// percentile and throughput in one of three formats:
+//
+//	text	one line for people
+//	json	one object per run, including every iteration's time
+//	csv	one row, for appending to a log, after a header line
+//		printed with the first report of the process
+//
+// The strings, which can hold file names, are quoted as each
+// format requires.
+//
+// An iteration analyses threads copies of the graph at once, so
+// throughput counts blocks and edges times threads per second.
+
+#ifndef HAVLAK_BENCH_H
+#define HAVLAK_BENCH_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct BenchInfo {
+	const char *program;
+	const char *engine;
+	const char *graph;	// how the graph was made, e.g. "gen:random:1000:0:1"
+	long long blocks;
+	long long edges;
+	long long loops;
+	int threads;
+	int warmup;
+};
+
+// benchPercentile returns the p'th percentile of sorted t,
+// by the nearest rank method.
+
+inline double benchPercentile(const std::vector<double> &t, double p) {
+	if (t.empty())
+		return 0;
+	int i = (int)ceil(p / 100 * t.size()) - 1;
+	if (i < 0)
+		i = 0;
+	return t[i];
+}
+
+// BenchFormatOK reports whether BenchReport knows format.
+
+inline bool BenchFormatOK(const char *format) {
+	return strcmp(format, "text") == 0 || strcmp(format, "json") == 0 || strcmp(format, "csv") == 0;
+}
+
+// benchJSON writes s as a JSON string.
+
+inline void benchJSON(FILE *f, const char *s) {
+	putc('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			putc(c, f);
+	}
+	putc('"', f);
+}
+
+// benchCSV writes s as a CSV field, quoting it if it holds
+// a comma, a quote or a line break.
+
+inline void benchCSV(FILE *f, const char *s) {
+	if (strpbrk(s, ",\"\r\n") == NULL) {
+		fputs(s, f);
+		return;
+	}
+	putc('"', f);
+	for (; *s; s++) {
+		if (*s == '"')
+			putc('"', f);
+		putc(*s, f);
+	}
+	putc('"', f);
+}
+
+inline void BenchReport(FILE *f, const char *format, const BenchInfo &b, const std::vector<double> &times) {
+	std::vector<double> t = times;
+	std::sort(t.begin(), t.end());
+	double min = t.empty() ? 0 : t[0];
+	double med = benchPercentile(t, 50);
+	double p99 = benchPercentile(t, 99);
+	double bps = med > 0 ? b.blocks * b.threads / med : 0;
+	double eps = med > 0 ? b.edges * b.threads / med : 0;
+
+	if (strcmp(format, "json") == 0) {
+		fprintf(f, "{\"program\": ");
+		benchJSON(f, b.program);
+		fprintf(f, ", \"engine\": ");
+		benchJSON(f, b.engine);
+		fprintf(f, ", \"graph\": ");
+		benchJSON(f, b.graph);
+		fprintf(f, ", \"blocks\": %lld, \"edges\": %lld, \"loops\": %lld, "
+			"\"threads\": %d, \"warmup\": %d, \"iterations\": %d, "
+			"\"min\": %.9f, \"median\": %.9f, \"p99\": %.9f, "
+			"\"blocks_per_sec\": %.0f, \"edges_per_sec\": %.0f, \"times\": [",
+			b.blocks, b.edges, b.loops,
+			b.threads, b.warmup, (int)times.size(), min, med, p99, bps, eps);
+		for (size_t i = 0; i < times.size(); i++)
+			fprintf(f, "%s%.9f", i > 0 ? ", " : "", times[i]);
+		fprintf(f, "]}\n");
+	} else if (strcmp(format, "csv") == 0) {
+		static bool header;
+		if (!header) {
+			fprintf(f, "program,engine,graph,blocks,edges,loops,threads,warmup,iterations,"
+				"min,median,p99,blocks_per_sec,edges_per_sec\n");
+			header = true;
+		}
+		benchCSV(f, b.program);
+		putc(',', f);
+		benchCSV(f, b.engine);
+		putc(',', f);
+		benchCSV(f, b.graph);
+		fprintf(f, ",%lld,%lld,%lld,%d,%d,%d,%.9f,%.9f,%.9f,%.0f,%.0f\n",
+			b.blocks, b.edges, b.loops,
+			b.threads, b.warmup, (int)times.size(), min, med, p99, bps, eps);
+	} else {
+		fprintf(f, "%s %s %s: %d iterations, min %.3fms, median %.3fms, p99 %.3fms, "
+			"%.1fM blocks/s, %.1fM edges/s\n",
+			b.program, b.engine, b.graph, (int)times.size(),
+			min * 1e3, med * 1e3, p99 * 1e3, bps / 1e6, eps / 1e6);
+	}
+}
+
+#endif  // HAVLAK_BENCH_H
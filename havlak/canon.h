@@ -0,0 +1,62 @@
+// Canonical loop forests, for comparing the results of the
+// C++ loop finders (see havlakdiff.cc).
+//
+// A forest is written as text, one loop per line, in order of
+// header block:
+//
+//	<header> <parent> <r|i>: <block> <block> ...
+//
+// parent is the header of the enclosing loop, or -1 for an
+// outermost loop; r or i says whether the loop is reducible; and
+// the blocks, in increasing order, are the header and the blocks
+// directly in the loop, not in a nested one. The artificial root
+// loop is omitted.
+
+#ifndef HAVLAK_CANON_H
+#define HAVLAK_CANON_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct CanonLoop {
+	int head;
+	int parent;
+	bool reducible;
+	std::vector<int> block;
+
+	bool operator<(const CanonLoop &l) const {
+		return this->head < l.head;
+	}
+};
+
+// WriteCanon sorts loops and writes them to file.
+// It reports errors itself and returns false.
+
+inline bool WriteCanon(const char *file, std::vector<CanonLoop> *loops) {
+	FILE *f = fopen(file, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return false;
+	}
+	std::sort(loops->begin(), loops->end());
+	for (size_t i = 0; i < loops->size(); i++) {
+		CanonLoop *l = &(*loops)[i];
+		std::sort(l->block.begin(), l->block.end());
+		l->block.erase(std::unique(l->block.begin(), l->block.end()), l->block.end());
+		fprintf(f, "%d %d %c:", l->head, l->parent, l->reducible ? 'r' : 'i');
+		for (size_t j = 0; j < l->block.size(); j++)
+			fprintf(f, " %d", l->block[j]);
+		fprintf(f, "\n");
+	}
+	int err = ferror(f);
+	if (fclose(f) != 0 || err) {
+		fprintf(stderr, "%s: write error\n", file);
+		return false;
+	}
+	return true;
+}
+
+#endif  // HAVLAK_CANON_H
@@ -0,0 +1,198 @@
+// Binary CFG files, shared by the C++ loop finders.
+//
+// A CFG file holds a graph in compressed sparse row form, laid
+// out so that it can be mapped into memory and used in place:
+//
+//	header	CFGFileHeader, 32 bytes
+//	inOff	int32[nblock+1]
+//	in	int32[nedge]
+//	outOff	int32[nblock+1]
+//	out	int32[nedge]
+//
+// The predecessors of block b are in[inOff[b]] through
+// in[inOff[b+1]-1], and likewise for out. Block 0 is the entry.
+// Integers are in the byte order of the machine that wrote the
+// file; readers reject files whose byteOrder does not match.
+
+#ifndef HAVLAK_CFGFILE_H
+#define HAVLAK_CFGFILE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+struct CFGFileHeader {
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t version;
+	uint32_t nblock;
+	uint32_t nedge;
+	uint32_t reserved[2];
+};
+
+static const char CFGFileMagic[8] = {'h', 'a', 'v', 'l', 'k', 'c', 'f', 'g'};
+static const uint32_t CFGFileByteOrder = 0x01020304;
+static const uint32_t CFGFileVersion = 1;
+
+// CFGFileSize returns the size of a file holding the given graph.
+inline uint64_t CFGFileSize(uint64_t nblock, uint64_t nedge) {
+	return sizeof(CFGFileHeader) + 4 * (2*(nblock+1) + 2*nedge);
+}
+
+// WriteCFGFile writes the given graph to file.
+// On error it prints a message and returns false.
+inline bool WriteCFGFile(const char *file, int nblock, int nedge,
+	const int *inOff, const int *in, const int *outOff, const int *out) {
+	FILE *f = fopen(file, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return false;
+	}
+	CFGFileHeader h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, CFGFileMagic, sizeof h.magic);
+	h.byteOrder = CFGFileByteOrder;
+	h.version = CFGFileVersion;
+	h.nblock = nblock;
+	h.nedge = nedge;
+	fwrite(&h, sizeof h, 1, f);
+	fwrite(inOff, 4, nblock+1, f);
+	fwrite(in, 4, nedge, f);
+	fwrite(outOff, 4, nblock+1, f);
+	fwrite(out, 4, nedge, f);
+	int err = ferror(f);
+	if (fclose(f) != 0 || err) {
+		fprintf(stderr, "%s: write error\n", file);
+		return false;
+	}
+	return true;
+}
+
+// checkCFGRows reports whether off runs from 0 to nedge without
+// decreasing and every entry of adj is a block.
+inline bool checkCFGRows(int nblock, int nedge, const int32_t *off, const int32_t *adj) {
+	if (off[0] != 0 || off[nblock] != nedge)
+		return false;
+	for (int b = 0; b < nblock; b++)
+		if (off[b+1] < off[b])
+			return false;
+	for (int i = 0; i < nedge; i++)
+		if (adj[i] < 0 || adj[i] >= nblock)
+			return false;
+	return true;
+}
+
+// CheckCFGFile checks that the offsets of a file mapped by
+// MapCFGFile never decrease and that every entry of in and out is
+// a block, so that readers can index by them safely. It reads every
+// page of the arrays. On error it prints a message and returns false.
+inline bool CheckCFGFile(const char *file, const CFGFileHeader *h) {
+	int nblock = h->nblock;
+	int nedge = h->nedge;
+	const int32_t *inOff = (const int32_t*)(h+1);
+	const int32_t *in = inOff + nblock+1;
+	const int32_t *outOff = in + nedge;
+	const int32_t *out = outOff + nblock+1;
+	if (!checkCFGRows(nblock, nedge, inOff, in) || !checkCFGRows(nblock, nedge, outOff, out)) {
+		fprintf(stderr, "%s: corrupt CFG file\n", file);
+		return false;
+	}
+	return true;
+}
+
+// CheckCFGEdges checks that in and out of a file that passed
+// CheckCFGFile hold the same edges: that v is listed as often among
+// the predecessors of w as w is among the successors of v. It takes
+// time and memory in proportion to the graph. On error it prints a
+// message and returns false.
+inline bool CheckCFGEdges(const char *file, const CFGFileHeader *h) {
+	int nblock = h->nblock;
+	int nedge = h->nedge;
+	const int32_t *inOff = (const int32_t*)(h+1);
+	const int32_t *in = inOff + nblock+1;
+	const int32_t *outOff = in + nedge;
+	const int32_t *out = outOff + nblock+1;
+
+	// Transpose out into rows of predecessors, in increasing
+	// order, and compare each with the sorted row of in.
+	std::vector<int32_t> off(nblock+1), pred(nedge), row;
+	for (int i = 0; i < nedge; i++)
+		off[out[i]+1]++;
+	for (int b = 0; b < nblock; b++)
+		off[b+1] += off[b];
+	std::vector<int32_t> next(off.begin(), off.end()-1);
+	for (int v = 0; v < nblock; v++)
+		for (int i = outOff[v]; i < outOff[v+1]; i++)
+			pred[next[out[i]]++] = v;
+	for (int w = 0; w < nblock; w++) {
+		if (inOff[w+1] - inOff[w] != off[w+1] - off[w])
+			goto bad;
+		row.assign(in + inOff[w], in + inOff[w+1]);
+		std::sort(row.begin(), row.end());
+		if (!std::equal(row.begin(), row.end(), pred.begin() + off[w]))
+			goto bad;
+	}
+	return true;
+
+bad:
+	fprintf(stderr, "%s: corrupt CFG file: in and out disagree\n", file);
+	return false;
+}
+
+// MapCFGFile maps file into memory, read-only, and checks its header.
+// On success it returns the header, at the start of the mapping,
+// and sets *size to the size of the mapping; the four arrays follow
+// the header. On error it prints a message and returns NULL.
+// The contents of the arrays are not checked; see CheckCFGFile.
+inline const CFGFileHeader *MapCFGFile(const char *file, size_t *size) {
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < (off_t)sizeof(CFGFileHeader)) {
+		fprintf(stderr, "%s: not a CFG file\n", file);
+		close(fd);
+		return NULL;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return NULL;
+	}
+
+	const CFGFileHeader *h = (const CFGFileHeader*)p;
+	const char *err = NULL;
+	if (memcmp(h->magic, CFGFileMagic, sizeof h->magic) != 0)
+		err = "not a CFG file";
+	else if (h->byteOrder != CFGFileByteOrder)
+		err = "CFG file has wrong byte order";
+	else if (h->version != CFGFileVersion)
+		err = "unsupported CFG file version";
+	else if (h->nblock > 0x7ffffffe || h->nedge > 0x7fffffff ||
+		 CFGFileSize(h->nblock, h->nedge) != (uint64_t)st.st_size)
+		err = "CFG file has wrong size";
+	if (err != NULL) {
+		fprintf(stderr, "%s: %s\n", file, err);
+		munmap(p, st.st_size);
+		return NULL;
+	}
+	*size = st.st_size;
+	return h;
+}
+
+#endif  // HAVLAK_CFGFILE_H
@@ -0,0 +1,221 @@
+// Synthetic CFG families for scaling benchmarks, shared by the
+// C++ loop finders.
+//
+// GenCFG builds a graph from a named family as a list of edges
+// src[i] -> dst[i] with entry block 0. The graph depends only on
+// (family, nblock, nedge, seed), so any run can be reproduced from
+// those four values. nblock and nedge are targets: some families
+// round the block count to fit their shape, and every family needs
+// a minimum number of edges to keep all blocks reachable; nedge 0
+// asks for the family's natural density.
+//
+//	random		random spanning tree plus uniformly random edges
+//	deepnest	one loop nest as deep as the block count allows,
+//			with extra edges jumping out to enclosing latches
+//	fanin		loops whose headers switch to many cases that all
+//			rejoin at the latch, with extra case-to-case edges
+//	chain		one long path with extra back edges to recent blocks
+//	lattice		a grid with right and down edges plus extra up
+//			edges, each entering a column cycle from two sides,
+//			so almost every loop is irreducible
+//	powerlaw	random spanning tree plus edges whose destinations
+//			are chosen by preferential attachment, giving a
+//			power-law in-degree distribution
+
+#ifndef HAVLAK_CFGGEN_H
+#define HAVLAK_CFGGEN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+static const char *const GenFamilies = "random, deepnest, fanin, chain, lattice, powerlaw";
+
+// GenRand is a splitmix64 generator: small, fast, and the same
+// on every platform, unlike the distributions in <random>.
+struct GenRand {
+	uint64_t s;
+
+	GenRand(uint64_t seed) : s(seed) {}
+	uint64_t Next() {
+		uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+	// Intn returns a number in [0, n).
+	int Intn(int n) {
+		return (int)(((Next() >> 32) * (uint64_t)n) >> 32);
+	}
+};
+
+struct GenEdges {
+	std::vector<int> *src;
+	std::vector<int> *dst;
+
+	void Add(int s, int d) {
+		src->push_back(s);
+		dst->push_back(d);
+	}
+	int Size() {
+		return src->size();
+	}
+};
+
+// genTree connects every block b > 0 from a random earlier block,
+// so that all are reachable from block 0.
+
+inline void genTree(GenEdges *e, GenRand *r, int nblock) {
+	for (int b = 1; b < nblock; b++)
+		e->Add(r->Intn(b), b);
+}
+
+inline int genRandom(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	genTree(e, r, nblock);
+	while (e->Size() < nedge)
+		e->Add(r->Intn(nblock), r->Intn(nblock));
+	return nblock;
+}
+
+inline int genPowerLaw(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	genTree(e, r, nblock);
+	while (e->Size() < nedge) {
+		// Half the time pick the destination of a random edge,
+		// which favours blocks in proportion to their in-degree.
+		int d;
+		if (r->Intn(2) == 0 && e->Size() > 0)
+			d = (*e->dst)[r->Intn(e->Size())];
+		else
+			d = r->Intn(nblock);
+		e->Add(r->Intn(nblock), d);
+	}
+	return nblock;
+}
+
+// genDeepNest builds loops i = 0 .. depth-1, loop i+1 nested in
+// loop i: head[i] -> head[i+1], latch[i+1] -> latch[i], and the
+// back edge latch[i] -> head[i]. An extra edge head[i] -> latch[j]
+// with j <= i stays inside loop j, so the nest stays reducible.
+
+inline int genDeepNest(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	int depth = nblock/2;
+	if (depth < 1)
+		depth = 1;
+	// Block 0 is head[0]; latch[i] is block depth+i.
+	for (int i = 0; i+1 < depth; i++) {
+		e->Add(i, i+1);
+		e->Add(depth+i+1, depth+i);
+	}
+	e->Add(depth-1, 2*depth-1);
+	for (int i = 0; i < depth; i++)
+		e->Add(depth+i, i);
+	while (e->Size() < nedge) {
+		int i = r->Intn(depth);
+		e->Add(i, depth + r->Intn(i+1));
+	}
+	return 2*depth;
+}
+
+// genFanIn builds a sequence of loops, each a header that branches
+// to width cases rejoining at a latch, which loops back to the
+// header and falls through to the next header.
+
+inline int genFanIn(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	int width = (int)sqrt((double)nblock);
+	if (width < 1)
+		width = 1;
+	int nloop = nblock / (width+2);
+	if (nloop < 1)
+		nloop = 1;
+	int unit = width+2;
+	for (int l = 0; l < nloop; l++) {
+		int head = l*unit;
+		int latch = head+width+1;
+		for (int c = 1; c <= width; c++) {
+			e->Add(head, head+c);
+			e->Add(head+c, latch);
+		}
+		e->Add(latch, head);
+		if (l+1 < nloop)
+			e->Add(latch, latch+1);
+	}
+	while (e->Size() < nedge && width > 1) {
+		int head = r->Intn(nloop) * unit;
+		int c = 1 + r->Intn(width-1);
+		e->Add(head+c, head+c+1+r->Intn(width-c));
+	}
+	return nloop*unit;
+}
+
+// genChain builds the path 0 -> 1 -> ... -> nblock-1 and adds back
+// edges from each chosen block to one of the 64 before it.
+
+inline int genChain(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	for (int b = 0; b+1 < nblock; b++)
+		e->Add(b, b+1);
+	while (e->Size() < nedge && nblock > 1) {
+		int b = 1 + r->Intn(nblock-1);
+		int back = 1 + r->Intn(b < 64 ? b : 64);
+		e->Add(b, b-back);
+	}
+	return nblock;
+}
+
+// genLattice builds a rows x cols grid, cell (y, x) being block
+// y*cols + x, with edges right and down. An up edge (y, x) ->
+// (y-1, x) makes a cycle that can be entered from the left at
+// either of its blocks, so it is irreducible.
+
+inline int genLattice(GenEdges *e, GenRand *r, int nblock, int nedge) {
+	int cols = (int)sqrt((double)nblock);
+	if (cols < 1)
+		cols = 1;
+	int rows = nblock / cols;
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < cols; x++) {
+			int b = y*cols + x;
+			if (x+1 < cols)
+				e->Add(b, b+1);
+			if (y+1 < rows)
+				e->Add(b, b+cols);
+		}
+	}
+	while (e->Size() < nedge && rows > 1) {
+		int b = cols + r->Intn((rows-1)*cols);
+		e->Add(b, b-cols);
+	}
+	return rows*cols;
+}
+
+// GenCFG sets src and dst to the edges of a graph from family
+// and returns its number of blocks, or -1 if family is unknown.
+
+inline int GenCFG(const char *family, int nblock, int nedge, uint64_t seed,
+		std::vector<int> *src, std::vector<int> *dst) {
+	if (nblock < 1)
+		nblock = 1;
+	if (nedge <= 0)
+		nedge = 2*nblock;
+	src->clear();
+	dst->clear();
+	src->reserve(nedge);
+	dst->reserve(nedge);
+	GenEdges e = {src, dst};
+	GenRand r(seed);
+	if (strcmp(family, "random") == 0)
+		return genRandom(&e, &r, nblock, nedge);
+	if (strcmp(family, "deepnest") == 0)
+		return genDeepNest(&e, &r, nblock, nedge);
+	if (strcmp(family, "fanin") == 0)
+		return genFanIn(&e, &r, nblock, nedge);
+	if (strcmp(family, "chain") == 0)
+		return genChain(&e, &r, nblock, nedge);
+	if (strcmp(family, "lattice") == 0)
+		return genLattice(&e, &r, nblock, nedge);
+	if (strcmp(family, "powerlaw") == 0)
+		return genPowerLaw(&e, &r, nblock, nedge);
+	return -1;
+}
+
+#endif  // HAVLAK_CFGGEN_H
@@ -14,7 +14,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <new>
 #include <list>
 #include <map>
 #include <set>
@@ -27,6 +33,51 @@
 #include <vector>
 #include <algorithm>
 
+#include "bench.h"
+#include "canon.h"
+#include "cfgfile.h"
+#include "cfggen.h"
+#include "perfcount.h"
+#include "profile.h"
+#include "workpool.h"
+
+//
+// Allocation accounting. Every allocation is counted, per thread,
+// against the phase the thread is in: building the MaoCFG, finding
+// loops, or building the LoopStructureGraph. AllocPhase marks the
+// phase for the duration of a scope; phases nest.
+//
+enum AllocPhaseId {
+  kPhaseOther,
+  kPhaseMaoCFG,
+  kPhaseFindLoops,
+  kPhaseLoopStructureGraph,
+  kNumPhases
+};
+
+static const char *const kPhaseNames[kNumPhases] = {
+  "other", "MaoCFG", "FindLoops", "LoopStructureGraph"
+};
+
+struct AllocCounts {
+  int64_t count;
+  int64_t bytes;
+};
+
+static thread_local AllocCounts alloc_counts[kNumPhases];
+static thread_local int alloc_phase = kPhaseOther;
+
+class AllocPhase {
+ public:
+  explicit AllocPhase(int phase) : saved_(alloc_phase) {
+    alloc_phase = phase;
+  }
+  ~AllocPhase() { alloc_phase = saved_; }
+
+ private:
+  int saved_;
+};
+
 // Forward Decls
 class BasicBlock;
 class MaoCFG;
@@ -50,15 +101,23 @@ class BasicBlockEdge {
 };
 
 // BasicBlock only maintains a vector of in-edges and
-// a vector of out-edges.
+// a vector of out-edges. Besides its name, each block has an id,
+// its index among the blocks of its CFG; ids run from 0 to the
+// number of blocks - 1.
 //
 class BasicBlock {
  public:
   typedef std::vector<BasicBlock *> EdgeVector;
 
-  explicit BasicBlock(int name) : name_(name) {
+  BasicBlock(int name, int id) : name_(name), id_(id), dead_(false) {
   }
 
+  int name() const { return name_; }
+  int id() const { return id_; }
+  void set_id(int id) { id_ = id; }
+  bool dead() const { return dead_; }
+  void set_dead() { dead_ = true; }
+
   EdgeVector *in_edges() { return &in_edges_; }
   EdgeVector *out_edges() { return &out_edges_; }
 
@@ -68,25 +127,56 @@ class BasicBlock {
   void AddOutEdge(BasicBlock *to) { out_edges_.push_back(to); }
   void AddInEdge(BasicBlock *from) { in_edges_.push_back(from); }
 
+  // Remove the last edge to or from a block, keeping the others
+  // in order; report whether there was one.
+  bool RemoveOutEdge(BasicBlock *to) { return RemoveLast(&out_edges_, to); }
+  bool RemoveInEdge(BasicBlock *from) { return RemoveLast(&in_edges_, from); }
+
  private:
+  static bool RemoveLast(EdgeVector *edges, BasicBlock *node) {
+    for (int i = edges->size() - 1; i >= 0; --i) {
+      if ((*edges)[i] == node) {
+        edges->erase(edges->begin() + i);
+        return true;
+      }
+    }
+    return false;
+  }
+
   EdgeVector in_edges_, out_edges_;
   int name_;
+  int id_;
+  bool dead_;
 };
 
-// MaoCFG maintains a list of nodes.
+// MaoCFG maintains a list of nodes, indexed by id, and an index
+// from names to nodes. The name index is a map by default; in
+// dense-name mode it is a vector indexed by name, which is faster
+// when names are small integers like 0..n-1.
+//
+// Edges and nodes can be removed as well as added. A removed node
+// loses its edges and its name at once, but stays in the list of
+// nodes, unreachable, until Compact drops it and renumbers the ids.
 //
 class MaoCFG {
  public:
-  typedef std::map<int, BasicBlock *> NodeMap;
+  typedef std::vector<BasicBlock *> NodeMap;
+  typedef std::map<int, BasicBlock *> NameMap;
   typedef std::list<BasicBlockEdge *> EdgeList;
 
-  MaoCFG() : start_node_(NULL) {
+  enum NameIndex {
+    kSparseNames,
+    kDenseNames
+  };
+
+  explicit MaoCFG(NameIndex name_index = kSparseNames)
+    : name_index_(name_index), start_node_(NULL) {
   }
 
   ~MaoCFG() {
     for (NodeMap::iterator it = basic_block_map_.begin();
          it != basic_block_map_.end(); ++it)
-      delete (*it).second;
+      delete (*it);
 
     for (EdgeList::iterator edge_it = edge_list_.begin();
          edge_it != edge_list_.end(); ++edge_it)
@@ -94,15 +184,22 @@ class MaoCFG {
   }
 
   BasicBlock *CreateNode(int name) {
-    BasicBlock *node;
+    AllocPhase phase(kPhaseMaoCFG);
+    BasicBlock **slot;
 
-    NodeMap::iterator it = basic_block_map_.find(name);
-
-    if (it == basic_block_map_.end()) {
-      node = new BasicBlock(name);
-      basic_block_map_[name] = node;
+    if (name_index_ == kDenseNames) {
+      if (name >= static_cast<int>(dense_names_.size()))
+        dense_names_.resize(name + 1);
+      slot = &dense_names_[name];
     } else {
-      node = (*it).second;
+      slot = &sparse_names_[name];
+    }
+
+    BasicBlock *node = *slot;
+    if (!node) {
+      node = new BasicBlock(name, GetNumNodes());
+      basic_block_map_.push_back(node);
+      *slot = node;
     }
 
     if (GetNumNodes() == 1)
@@ -115,6 +212,70 @@ class MaoCFG {
     edge_list_.push_back(edge);
   }
 
+  // FindNode returns the node named name, or NULL if there is none.
+  BasicBlock *FindNode(int name) {
+    if (name_index_ == kDenseNames)
+      return name >= 0 && name < static_cast<int>(dense_names_.size()) ?
+          dense_names_[name] : NULL;
+    NameMap::iterator it = sparse_names_.find(name);
+    return it == sparse_names_.end() ? NULL : it->second;
+  }
+
+  // RemoveEdge removes the most recently added edge from -> to,
+  // reporting whether there was one. The edge list is searched
+  // from the end, where recent edges are.
+  bool RemoveEdge(int from_name, int to_name) {
+    BasicBlock *from = FindNode(from_name);
+    BasicBlock *to = FindNode(to_name);
+    if (!from || !to || !from->RemoveOutEdge(to))
+      return false;
+    to->RemoveInEdge(from);
+    for (EdgeList::iterator it = edge_list_.end(); it != edge_list_.begin(); ) {
+      --it;
+      if ((*it)->GetSrc() == from && (*it)->GetDst() == to) {
+        delete *it;
+        edge_list_.erase(it);
+        break;
+      }
+    }
+    return true;
+  }
+
+  // RemoveNode removes the edges of the node named name, and the
+  // name, so that it can be reused. It reports whether there was
+  // such a node; the start node cannot be removed.
+  bool RemoveNode(int name) {
+    BasicBlock *node = FindNode(name);
+    if (!node || node == start_node_)
+      return false;
+    while (!node->out_edges()->empty())
+      RemoveEdge(name, node->out_edges()->back()->name());
+    while (!node->in_edges()->empty())
+      RemoveEdge(node->in_edges()->back()->name(), name);
+    if (name_index_ == kDenseNames)
+      dense_names_[name] = NULL;
+    else
+      sparse_names_.erase(name);
+    node->set_dead();
+    return true;
+  }
+
+  // Compact deletes the removed nodes and renumbers the others'
+  // ids in order.
+  void Compact() {
+    int k = 0;
+    for (size_t i = 0; i < basic_block_map_.size(); ++i) {
+      BasicBlock *node = basic_block_map_[i];
+      if (node->dead()) {
+        delete node;
+        continue;
+      }
+      node->set_id(k);
+      basic_block_map_[k++] = node;
+    }
+    basic_block_map_.resize(k);
+  }
+
   int GetNumNodes() {
     return basic_block_map_.size();
   }
@@ -131,12 +292,16 @@ class MaoCFG {
     return edge->GetSrc();
   }
 
+  // All nodes, indexed by id.
   NodeMap *GetBasicBlocks() {
     return &basic_block_map_;
   }
 
  private:
+  NameIndex     name_index_;
   NodeMap       basic_block_map_;
+  NameMap       sparse_names_;
+  NodeMap       dense_names_;
   BasicBlock   *start_node_;
   EdgeList      edge_list_;
 };
@@ -163,8 +328,8 @@ class SimpleLoop {
   typedef std::set<SimpleLoop *> LoopSet;
 
 
-  SimpleLoop() : parent_(NULL), is_root_(false), nesting_level_(0),
-                 depth_level_(0) {
+  SimpleLoop() : parent_(NULL), header_(NULL), is_root_(false),
+                 is_reducible_(true), nesting_level_(0), depth_level_(0) {
   }
 
   void AddNode(BasicBlock *basic_block) {
@@ -185,8 +350,14 @@ class SimpleLoop {
     return &children_;
   }
 
+  BasicBlockSet *GetBasicBlocks() {
+    return &basic_blocks_;
+  }
+
   // Getters/Setters
   SimpleLoop  *parent() { return parent_; }
+  BasicBlock  *header() { return header_; }
+  bool         is_reducible() const { return is_reducible_; }
   int          nesting_level() const { return nesting_level_; }
   int          depth_level() const { return depth_level_; }
   int          counter() const { return counter_; }
@@ -197,6 +368,8 @@ class SimpleLoop {
     parent->AddChildLoop(this);
   }
 
+  void set_header(BasicBlock *header) { header_ = header; }
+  void set_is_reducible(bool reducible) { is_reducible_ = reducible; }
   void set_is_root() { is_root_ = true; }
   void set_counter(int value) { counter_ = value; }
   void set_nesting_level(int level) {
@@ -210,8 +383,10 @@ class SimpleLoop {
   BasicBlockSet          basic_blocks_;
   std::set<SimpleLoop *> children_;
   SimpleLoop            *parent_;
+  BasicBlock            *header_;
 
   bool         is_root_: 1;
+  bool         is_reducible_: 1;
   int          counter_;
   int          nesting_level_;
   int          depth_level_;
@@ -306,6 +481,31 @@ class LoopStructureGraph {
 
   SimpleLoop *root() const { return root_; }
 
+  //
+  // WriteCanon writes the loop forest in the canonical form
+  // of canon.h, for comparison with the other loop finders.
+  //
+  bool WriteCanon(const char *file) {
+    std::vector<CanonLoop> canon;
+    for (LoopList::iterator it = loops_.begin(); it != loops_.end(); ++it) {
+      SimpleLoop *loop = *it;
+      if (loop == root_) continue;
+      CanonLoop c;
+      c.head = loop->header()->id();
+      c.parent = -1;
+      if (loop->parent() && loop->parent() != root_)
+        c.parent = loop->parent()->header()->id();
+      c.reducible = loop->is_reducible();
+      c.block.push_back(c.head);
+      SimpleLoop::BasicBlockSet *blocks = loop->GetBasicBlocks();
+      for (SimpleLoop::BasicBlockSet::iterator bb = blocks->begin();
+           bb != blocks->end(); ++bb)
+        c.block.push_back((*bb)->id());
+      canon.push_back(c);
+    }
+    return ::WriteCanon(file, &canon);
+  }
+
  private:
   SimpleLoop   *root_;
   LoopList      loops_;
@@ -316,6 +516,7 @@ inline
 BasicBlockEdge::BasicBlockEdge(MaoCFG     *cfg,
                                int         from_name,
                                int         to_name) {
+  AllocPhase phase(kPhaseMaoCFG);
   from_ = cfg->CreateNode(from_name);
   to_ = cfg->CreateNode(to_name);
 
@@ -326,76 +527,327 @@ BasicBlockEdge::BasicBlockEdge(MaoCFG     *cfg,
 }
 
 
-// External entry point.
+// External entry points.
+class HavlakWorkspace;
 int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG);
+int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG,
+                    HavlakWorkspace *workspace);
 
 //
-// Union/Find algorithm after Tarjan, R.E., 1983, Data Structures
-// and Network Algorithms.
+// UnionFindNode
+//
+// Per-node state of the loop finder: the basic block, its DFS
+// number, and the loop it heads, if any. Set membership is kept
+// separately, in UnionFind below, indexed by DFS number.
 //
 class UnionFindNode {
  public:
-  UnionFindNode() : parent_(NULL), bb_(NULL), loop_(NULL), dfs_number_(0) {
+  UnionFindNode() : bb_(NULL), loop_(NULL), dfs_number_(0) {
   }
 
   // Initialize this node.
   //
   void Init(BasicBlock *bb, int dfs_number) {
-    parent_     = this;
     bb_         = bb;
+    loop_       = NULL;
     dfs_number_ = dfs_number;
   }
 
+  // Getters/Setters
+  //
+  BasicBlock    *bb() const { return bb_; }
+  SimpleLoop    *loop() const { return loop_; }
+  int            dfs_number() const { return dfs_number_; }
+
+  void           set_loop(SimpleLoop *loop) { loop_ = loop; }
+
+ private:
+  BasicBlock    *bb_;
+  SimpleLoop    *loop_;
+  int            dfs_number_;
+};
+
+//
+// Union/Find algorithm after Tarjan, R.E., 1983, Data Structures
+// and Network Algorithms.
+//
+// Elements are DFS numbers. Parent links are 32-bit indices in a
+// single dense array; Union links by rank and FindSet halves paths
+// as it walks, so neither recurses nor allocates. Since the root of
+// a tree need not be the loop header, each root carries a label
+// naming the header of its set, and FindSet returns that label.
+//
+class UnionFind {
+ public:
+  typedef std::vector<int32_t> IndexVector;
+
+  UnionFind() : num_finds_(0), num_steps_(0) {
+  }
+
+  // Make each of the elements 0..size-1 a singleton set.
+  //
+  void Init(int size) {
+    nodes_.resize(size);
+    root_.resize(size);
+    rank_.assign(size, 0);
+    for (int i = 0; i < size; i++) {
+      nodes_[i].parent = i;
+      nodes_[i].label = i;
+      root_[i] = i;
+    }
+  }
+
   // Union/Find Algorithm - The find routine.
   //
-  // Implemented with Path Compression (inner loops are only
-  // visited and collapsed once, however, deep nests would still
-  // result in significant traversals).
+  // Returns the header of the set containing x.
+  //
+  int FindSet(int x) {
+    Node   *nodes = &nodes_[0];
+    int64_t steps = 0;
+    while (nodes[x].parent != x) {
+      steps++;
+      nodes[x].parent = nodes[nodes[x].parent].parent;
+      x = nodes[x].parent;
+    }
+    num_finds_++;
+    num_steps_ += steps;
+    return nodes[x].label;
+  }
+
+  // Union/Find Algorithm - The union routine.
+  //
+  // Merges the set headed by x into the set headed by header.
+  // Both must be headers, as returned by FindSet. The node pool
+  // holds each header at most once, so x has not been merged yet.
   //
-  UnionFindNode *FindSet() {
-    typedef std::list<UnionFindNode *> NodeListType;
-    NodeListType nodeList;
+  void Union(int x, int header) {
+    int rx = root_[x];
+    int rh = root_[header];
+    if (rx == rh) return;
+    if (rank_[rx] > rank_[rh])
+      std::swap(rx, rh);
+    else if (rank_[rx] == rank_[rh])
+      rank_[rh]++;
+    nodes_[rx].parent = rh;
+    nodes_[rh].label = header;
+    root_[header] = rh;
+  }
+
+  // Statistics: calls to FindSet, and parent links followed by them.
+  //
+  int64_t num_finds() const { return num_finds_; }
+  int64_t num_steps() const { return num_steps_; }
+
+ private:
+  struct Node {
+    int32_t parent;
+    int32_t label;  // header of the set, valid at roots
+  };
+
+  std::vector<Node>    nodes_;
+  IndexVector          root_;   // tree root of each header's set
+  std::vector<uint8_t> rank_;
+  int64_t              num_finds_;
+  int64_t              num_steps_;
+};
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//
+// FindLoopsStats
+//
+// Time spent in each phase of HavlakLoopFinder::FindLoops, summed
+// over the analyses run with one workspace, and, when counting is
+// enabled and the hardware allows it, the performance counters
+// (perfcount.h) read at the phase boundaries. The phases match
+// those of havlak6's LoopStats, except that steps c through e
+// interleave too finely to separate and are charged together.
+//
+class FindLoopsStats {
+ public:
+  enum Phase {
+    kInit,        // step a: reset the workspace
+    kDFS,         // step a: depth-first numbering
+    kClassify,    // step b: back and non-back edges
+    kSteps,       // steps c, d and e: find loop bodies
+    kBuildLoops,  // create the loop forest
+    kNumPhases
+  };
+
+  FindLoopsStats() { Reset(); }
 
-    UnionFindNode *node = this;
-    while (node != node->parent()) {
-      if (node->parent() != node->parent()->parent())
-        nodeList.push_back(node);
-      node = node->parent();
+  void Reset() { memset(this, 0, sizeof(*this)); }
+
+  // Charge the time and counts since *start and counts to phase,
+  // and advance both to now.
+  //
+  void Charge(Phase phase, double *start, PerfCounters *pc,
+              uint64_t *counts) {
+    double t = Now();
+    seconds_[phase] += t - *start;
+    *start = t;
+    if (pc) {
+      uint64_t v[PerfCounters::NCounter];
+      pc->Read(v);
+      for (int i = 0; i < PerfCounters::NCounter; i++) {
+        counters_[phase][i] += v[i] - counts[i];
+        counts[i] = v[i];
+      }
     }
+  }
 
-    // Path Compression, all nodes' parents point to the 1st level parent.
-    NodeListType::iterator iter = nodeList.begin();
-    NodeListType::iterator end  = nodeList.end();
-    for (; iter != end; ++iter)
-      (*iter)->set_parent(node->parent());
+  void Add(const FindLoopsStats &s) {
+    runs_ += s.runs_;
+    counted_ += s.counted_;
+    for (int p = 0; p < kNumPhases; p++) {
+      seconds_[p] += s.seconds_[p];
+      for (int i = 0; i < PerfCounters::NCounter; i++)
+        counters_[p][i] += s.counters_[p][i];
+    }
+  }
 
-    return node;
+  void Print(FILE *f) const {
+    static const char *const phase_name[kNumPhases] = {
+      "init", "dfs", "classify", "steps c-e", "buildloops"
+    };
+    if (runs_ == 0)
+      return;
+    fprintf(f, "find loops: %lld runs\n", (long long)runs_);
+    for (int p = 0; p < kNumPhases; p++)
+      fprintf(f, "  %-12s %10.3fms/run\n", phase_name[p],
+              seconds_[p] * 1e3 / runs_);
+    if (counted_ == 0)
+      return;
+    fprintf(f, "  %-12s", "per run");
+    for (int i = 0; i < PerfCounters::NCounter; i++)
+      fprintf(f, " %14s", PerfCounters::name[i]);
+    fprintf(f, "\n");
+    for (int p = 0; p < kNumPhases; p++) {
+      fprintf(f, "  %-12s", phase_name[p]);
+      for (int i = 0; i < PerfCounters::NCounter; i++)
+        fprintf(f, " %14llu",
+                (unsigned long long)(counters_[p][i] / counted_));
+      fprintf(f, "\n");
+    }
   }
 
-  // Union/Find Algorithm - The union routine.
+  int64_t counted() const { return counted_; }
+
+ private:
+  friend class HavlakLoopFinder;
+
+  int64_t  runs_;
+  int64_t  counted_;  // runs that read the counters
+  double   seconds_[kNumPhases];
+  uint64_t counters_[kNumPhases][PerfCounters::NCounter];
+};
+
+//
+// HavlakWorkspace
+//
+// Scratch state for HavlakLoopFinder. Passing the same workspace to
+// repeated FindHavlakLoops calls reuses its storage: once it has
+// analysed a CFG of a given size, analysing CFGs of that size or
+// smaller does not touch the heap. Only the loop forest itself is
+// allocated.
+//
+class HavlakWorkspace {
+ public:
   //
-  // We rely on path compression.
+  // Local types used for Havlak algorithm, all carefully
+  // selected to guarantee minimal complexity.
   //
-  void Union(UnionFindNode *B) {
-    set_parent(B);
-  }
+  typedef std::vector<UnionFindNode>          NodeVector;
+  typedef std::vector<int>                    BasicBlockMap;  // by id
+  typedef std::vector<int>                    IntVector;
+  typedef std::vector<IntVector>              IntVectorVector;
+  typedef std::vector<char>                   CharVector;
 
+  //
+  // DFSFrame
+  //
+  // A node on the DFS stack, its DFS number, and the index of
+  // its next unexplored out edge.
+  //
+  struct DFSFrame {
+    DFSFrame(BasicBlock *n, int num) : node(n), number(num), next(0) {
+    }
 
-  // Getters/Setters
+    BasicBlock *node;
+    int         number;
+    size_t      next;
+  };
+  typedef std::vector<DFSFrame>               DFSStack;
+
+  // Prepare to analyse a CFG with 'size' nodes, with every
+  // node unvisited and every list empty. Per-node vectors are only
+  // ever grown, so their elements keep their capacity.
   //
-  UnionFindNode *parent() const { return parent_; }
-  BasicBlock    *bb() const { return bb_; }
-  SimpleLoop    *loop() const { return loop_; }
-  int            dfs_number() const { return dfs_number_; }
+  void Reset(int size, int unvisited) {
+    if (back_preds_.size() < static_cast<size_t>(size)) {
+      back_preds_.resize(size);
+      non_back_preds_.resize(size);
+    }
+    for (int i = 0; i < size; i++) {
+      back_preds_[i].clear();
+      non_back_preds_[i].clear();
+    }
+    nodes_.assign(size, UnionFindNode());
+    number_.assign(size, unvisited);
+    last_.resize(size);
+    header_.resize(size);
+    type_.resize(size);
+    in_non_back_preds_.assign(size, unvisited);
+    in_pool_.assign(size, unvisited);
+    node_pool_.clear();
+    dfs_stack_.clear();
+    union_find_.Init(size);
+    loop_headers_.clear();
+    loop_ends_.clear();
+    loop_members_.clear();
+  }
 
-  void           set_parent(UnionFindNode *parent) { parent_ = parent; }
-  void           set_loop(SimpleLoop *loop) { loop_ = loop; }
+  const UnionFind &union_find() const { return union_find_; }
+
+  // Phase statistics, kept across Resets. With counters set,
+  // FindLoops also reads the hardware counters.
+  //
+  FindLoopsStats *stats() { return &stats_; }
+  void set_counters(bool counters) { counters_ = counters; }
 
  private:
-  UnionFindNode *parent_;
-  BasicBlock    *bb_;
-  SimpleLoop    *loop_;
-  int            dfs_number_;
+  friend class HavlakLoopFinder;
+
+  FindLoopsStats   stats_;
+  bool             counters_ = false;
+
+  NodeVector       nodes_;
+  BasicBlockMap    number_;
+  IntVector        last_;
+  IntVector        header_;
+  CharVector       type_;
+  IntVectorVector  back_preds_;
+  IntVectorVector  non_back_preds_;
+  DFSStack         dfs_stack_;
+  UnionFind        union_find_;      // loop bodies collapsed so far.
+
+  // Set membership stamps: a node is in non_back_preds_[w], or in
+  // the node pool of header w, when its stamp is w. Each header is
+  // processed once, so the stamps never need clearing.
+  IntVector        in_non_back_preds_;
+  IntVector        in_pool_;
+  IntVector        node_pool_;       // this is 'P' in Havlak's paper
+
+  // Loops found, in the order they are found: the header of loop i
+  // is loop_headers_[i], and its body is loop_members_[j] for j from
+  // loop_ends_[i-1] (or 0) up to loop_ends_[i].
+  IntVector        loop_headers_;
+  IntVector        loop_ends_;
+  IntVector        loop_members_;
 };
 
 //------------------------------------------------------------------
@@ -405,16 +857,17 @@ class UnionFindNode {
 //   Paul Havlak, Nesting of Reducible and Irreducible Loops,
 //      Rice University.
 //
-//   We avoid doing tree balancing and instead use path compression
-//   to avoid traversing parent pointers over and over.
+//   Sets are balanced by rank and paths halved on every find, so
+//   deep nests do not lead to long parent chains.
 //
 //   Most of the variable names and identifiers are taken literally
 //   from this paper (and the original Tarjan paper mentioned above).
 //-------------------------------------------------------------------
 class HavlakLoopFinder {
  public:
-  HavlakLoopFinder(MaoCFG *cfg, LoopStructureGraph *lsg) :
-    CFG_(cfg), lsg_(lsg) {
+  HavlakLoopFinder(MaoCFG *cfg, LoopStructureGraph *lsg,
+                   HavlakWorkspace *workspace) :
+    CFG_(cfg), lsg_(lsg), ws_(workspace), pc_(NULL), start_(0) {
   }
 
   enum BasicBlockClass {
@@ -435,19 +888,13 @@ class HavlakLoopFinder {
   // Safeguard against pathologic algorithm behavior.
   static const int kMaxNonBackPreds = (32*1024);
 
-  //
-  // Local types used for Havlak algorithm, all carefully
-  // selected to guarantee minimal complexity.
-  //
-  typedef std::vector<UnionFindNode>          NodeVector;
-  typedef std::map<BasicBlock*, int>          BasicBlockMap;
-  typedef std::list<int>                      IntList;
-  typedef std::set<int>                       IntSet;
-  typedef std::list<UnionFindNode*>           NodeList;
-  typedef std::vector<IntList>                IntListVector;
-  typedef std::vector<IntSet>                 IntSetVector;
-  typedef std::vector<int>                    IntVector;
-  typedef std::vector<char>                   CharVector;
+  typedef HavlakWorkspace::NodeVector       NodeVector;
+  typedef HavlakWorkspace::BasicBlockMap    BasicBlockMap;
+  typedef HavlakWorkspace::IntVector        IntVector;
+  typedef HavlakWorkspace::IntVectorVector  IntVectorVector;
+  typedef HavlakWorkspace::CharVector       CharVector;
+  typedef HavlakWorkspace::DFSFrame         DFSFrame;
+  typedef HavlakWorkspace::DFSStack         DFSStack;
 
   //
   // IsAncestor
@@ -472,24 +919,39 @@ class HavlakLoopFinder {
   //
   // DESCRIPTION:
   // Simple depth first traversal along out edges with node numbering.
+  // The traversal keeps an explicit stack of pending nodes instead of
+  // recursing, so long chains of basic blocks cannot overflow the
+  // thread stack. Nodes are numbered in the same preorder as the
+  // recursive formulation.
   //
-  int DFS(BasicBlock      *current_node,
+  int DFS(BasicBlock      *start_node,
           NodeVector      *nodes,
           BasicBlockMap   *number,
           IntVector       *last,
           const int       current) {
-    (*nodes)[current].Init(current_node, current);
-    (*number)[current_node] = current;
-
     int lastid = current;
-    for (BasicBlockIter outedges = current_node->out_edges()->begin();
-         outedges != current_node->out_edges()->end(); ++outedges) {
-      BasicBlock *target = *outedges;
-
-      if ((*number)[target] == kUnvisited)
-        lastid = DFS(target, nodes, number, last, lastid + 1);
+    (*nodes)[current].Init(start_node, current);
+    (*number)[start_node->id()] = current;
+
+    DFSStack &stack = ws_->dfs_stack_;
+    stack.push_back(DFSFrame(start_node, current));
+    while (!stack.empty()) {
+      DFSFrame *frame = &stack.back();
+      BasicBlock::EdgeVector *out_edges = frame->node->out_edges();
+      if (frame->next < out_edges->size()) {
+        BasicBlock *target = (*out_edges)[frame->next++];
+
+        if ((*number)[target->id()] == kUnvisited) {
+          lastid++;
+          (*nodes)[lastid].Init(target, lastid);
+          (*number)[target->id()] = lastid;
+          stack.push_back(DFSFrame(target, lastid));
+        }
+        continue;
+      }
+      (*last)[frame->number] = lastid;
+      stack.pop_back();
     }
-    (*last)[(*number)[current_node]] = lastid;
     return lastid;
   }
 
@@ -502,30 +964,62 @@ class HavlakLoopFinder {
   // paper (which is similar to the one used by Tarjan).
   //
   void FindLoops() {
-    if (!CFG_->GetStartBasicBlock()) return;
+    FindLoopsStats *stats = &ws_->stats_;
+    pc_ = ws_->counters_ ? ThreadCounters() : NULL;
+    start_ = Now();
+    if (pc_) pc_->Read(counts_);
+
+    bool found;
+    {
+      AllocPhase phase(kPhaseFindLoops);
+      found = Analyze();
+    }
+    // Whatever Analyze did after classifying, including giving
+    // up early, counts as steps c through e.
+    Charge(FindLoopsStats::kSteps);
+    if (found) {
+      AllocPhase phase(kPhaseLoopStructureGraph);
+      BuildLoops();
+    }
+    Charge(FindLoopsStats::kBuildLoops);
+    stats->runs_++;
+    if (pc_) stats->counted_++;
+  }
+
+  //
+  // Analyze
+  //
+  // Run steps a through e, recording the loops found in the
+  // workspace. Allocates nothing once the workspace is warm.
+  // Returns false if there is nothing to report.
+  //
+  bool Analyze() {
+    if (!CFG_->GetStartBasicBlock()) return false;
 
     int                size = CFG_->GetNumNodes();
 
-    IntSetVector       non_back_preds(size);
-    IntListVector      back_preds(size);
-    IntVector          header(size);
-    CharVector         type(size);
-    IntVector          last(size);
-    NodeVector         nodes(size);
-    BasicBlockMap      number;
+    ws_->Reset(size, kUnvisited);
+    Charge(FindLoopsStats::kInit);
+
+    IntVectorVector   &non_back_preds = ws_->non_back_preds_;
+    IntVectorVector   &back_preds = ws_->back_preds_;
+    IntVector         &header = ws_->header_;
+    CharVector        &type = ws_->type_;
+    IntVector         &last = ws_->last_;
+    NodeVector        &nodes = ws_->nodes_;
+    BasicBlockMap     &number = ws_->number_;
+    UnionFind         &union_find = ws_->union_find_;
+    IntVector         &in_non_back_preds = ws_->in_non_back_preds_;
+    IntVector         &in_pool = ws_->in_pool_;
+    IntVector         &node_pool = ws_->node_pool_;
 
     // Step a:
-    //   - initialize all nodes as unvisited.
+    //   - initialize all nodes as unvisited (done by Reset).
     //   - depth-first traversal and numbering.
     //   - unreached BB's are marked as dead.
     //
-    for (MaoCFG::NodeMap::iterator bb_iter =
-           CFG_->GetBasicBlocks()->begin();
-         bb_iter != CFG_->GetBasicBlocks()->end(); ++bb_iter) {
-      number[(*bb_iter).second] = kUnvisited;
-    }
-
     DFS(CFG_->GetStartBasicBlock(), &nodes, &number, &last, 0);
+    Charge(FindLoopsStats::kDFS);
 
     // Step b:
     //   - iterate over all nodes.
@@ -552,19 +1046,22 @@ class HavlakLoopFinder {
              inedges != node_w->in_edges()->end(); ++inedges) {
           BasicBlock     *node_v = *inedges;
 
-          int v = number[ node_v ];
+          int v = number[node_v->id()];
           if (v == kUnvisited) continue;  // dead node
 
-          if (IsAncestor(w, v, &last))
+          if (IsAncestor(w, v, &last)) {
             back_preds[w].push_back(v);
-          else
-            non_back_preds[w].insert(v);
+          } else if (in_non_back_preds[v] != w) {
+            in_non_back_preds[v] = w;
+            non_back_preds[w].push_back(v);
+          }
         }
       }
     }
 
     // Start node is root of all other loops.
     header[0] = 0;
+    Charge(FindLoopsStats::kClassify);
 
     // Step c:
     //
@@ -579,37 +1076,34 @@ class HavlakLoopFinder {
     // headers for surrounding loops.
     //
     for (int w = size-1; w >= 0; w--) {
-      NodeList    node_pool;  // this is 'P' in Havlak's paper
       BasicBlock *node_w = nodes[w].bb();
       if (!node_w) continue;  // dead BB
 
+      node_pool.clear();
+
       // Step d:
-      IntList::iterator back_pred_iter  = back_preds[w].begin();
-      IntList::iterator back_pred_end   = back_preds[w].end();
+      IntVector::iterator back_pred_iter  = back_preds[w].begin();
+      IntVector::iterator back_pred_end   = back_preds[w].end();
       for (; back_pred_iter != back_pred_end; back_pred_iter++) {
         int v = *back_pred_iter;
-        if (v != w)
-          node_pool.push_back(nodes[v].FindSet());
-        else
+        if (v != w) {
+          int x = union_find.FindSet(v);
+          if (in_pool[x] != w) {
+            in_pool[x] = w;
+            node_pool.push_back(x);
+          }
+        } else {
           type[w] = BB_SELF;
+        }
       }
 
-      // Copy node_pool to worklist.
-      //
-      NodeList worklist;
-      NodeList::iterator niter  = node_pool.begin();
-      NodeList::iterator nend   = node_pool.end();
-      for (;  niter != nend; ++niter)
-        worklist.push_back(*niter);
-
       if (!node_pool.empty())
         type[w] = BB_REDUCIBLE;
 
-      // work the list...
+      // work the list: the node pool, in order, is the worklist.
       //
-      while (!worklist.empty()) {
-        UnionFindNode x = *worklist.front();
-        worklist.pop_front();
+      for (size_t i = 0; i < node_pool.size(); i++) {
+        int x = node_pool[i];
 
         // Step e:
         //
@@ -623,80 +1117,113 @@ class HavlakLoopFinder {
         // The algorithm has degenerated. Break and
         // return in this case.
         //
-        size_t non_back_size = non_back_preds[x.dfs_number()].size();
-        if (non_back_size > kMaxNonBackPreds) {
-          lsg_->KillAll();
-          return;
-        }
-
-        IntSet::iterator non_back_pred_iter =
-          non_back_preds[x.dfs_number()].begin();
-        IntSet::iterator non_back_pred_end  =
-          non_back_preds[x.dfs_number()].end();
-        for (; non_back_pred_iter != non_back_pred_end; non_back_pred_iter++) {
-          UnionFindNode  y     = nodes[*non_back_pred_iter];
-          UnionFindNode *ydash = y.FindSet();
-
-          if (!IsAncestor(w, ydash->dfs_number(), &last)) {
-            type[w] = BB_IRREDUCIBLE;
-            non_back_preds[w].insert(ydash->dfs_number());
+        size_t non_back_size = non_back_preds[x].size();
+        if (non_back_size > kMaxNonBackPreds)
+          return false;
+
+        for (size_t j = 0; j < non_back_size; j++) {
+          int ydash = union_find.FindSet(non_back_preds[x][j]);
+
+          if (!IsAncestor(w, ydash, &last)) {
+            if (type[w] != BB_IRREDUCIBLE) {
+              // Stamp the existing entries before adding more.
+              type[w] = BB_IRREDUCIBLE;
+              for (size_t k = 0; k < non_back_preds[w].size(); k++)
+                in_non_back_preds[non_back_preds[w][k]] = w;
+            }
+            if (in_non_back_preds[ydash] != w) {
+              in_non_back_preds[ydash] = w;
+              non_back_preds[w].push_back(ydash);
+            }
           } else {
-            if (ydash->dfs_number() != w) {
-              NodeList::iterator nfind = find(node_pool.begin(),
-                                              node_pool.end(), ydash);
-              if (nfind == node_pool.end()) {
-                worklist.push_back(ydash);
-                node_pool.push_back(ydash);
-              }
+            if (ydash != w && in_pool[ydash] != w) {
+              in_pool[ydash] = w;
+              node_pool.push_back(ydash);
             }
           }
         }
       }
 
       // Collapse/Unionize nodes in a SCC to a single node
-      // For every SCC found, create a loop descriptor and link it in.
+      // For every SCC found, record a loop; BuildLoops creates the
+      // loop descriptors and links them in.
       //
       if (!node_pool.empty() || (type[w] == BB_SELF)) {
-        SimpleLoop* loop = lsg_->CreateNewLoop();
-
-        // At this point, one can set attributes to the loop, such as:
-        //
-        // the bottom node:
-        //    IntList::iterator iter  = back_preds[w].begin();
-        //    loop bottom is: nodes[*backp_iter].node);
-        //
-        // the number of backedges:
-        //    back_preds[w].size()
-        //
-        // whether this loop is reducible:
-        //    type[w] != BB_IRREDUCIBLE
-        //
-        // TODO(rhundt): Define those interfaces in the Loop Forest.
-        //
-        nodes[w].set_loop(loop);
-
-        for (niter = node_pool.begin(); niter != node_pool.end(); niter++) {
-          UnionFindNode  *node = (*niter);
+        ws_->loop_headers_.push_back(w);
+        for (size_t i = 0; i < node_pool.size(); i++) {
+          int node = node_pool[i];
 
           // Add nodes to loop descriptor.
-          header[node->dfs_number()] = w;
-          node->Union(&nodes[w]);
-
-          // Nested loops are not added, but linked together.
-          if (node->loop())
-            node->loop()->set_parent(loop);
-          else
-            loop->AddNode(node->bb());
+          header[node] = w;
+          union_find.Union(node, w);
+          ws_->loop_members_.push_back(node);
         }
-
-        lsg_->AddLoop(loop);
+        ws_->loop_ends_.push_back(ws_->loop_members_.size());
       }  // node_pool.size
     }  // Step c
-  }  // FindLoops
+    return true;
+  }  // Analyze
+
+  //
+  // BuildLoops
+  //
+  // Create a loop descriptor for every loop recorded by Analyze,
+  // in the order they were found, and link them into the loop forest.
+  //
+  void BuildLoops() {
+    NodeVector &nodes = ws_->nodes_;
+    IntVector  &members = ws_->loop_members_;
+
+    int start = 0;
+    for (size_t i = 0; i < ws_->loop_headers_.size(); i++) {
+      int w = ws_->loop_headers_[i];
+      SimpleLoop* loop = lsg_->CreateNewLoop();
+
+      // At this point, one can set attributes to the loop, such as:
+      //
+      // the bottom node:
+      //    IntVector::iterator iter  = back_preds[w].begin();
+      //    loop bottom is: nodes[*backp_iter].node);
+      //
+      // the number of backedges:
+      //    back_preds[w].size()
+      //
+      // TODO(rhundt): Define those interfaces in the Loop Forest.
+      //
+      loop->set_header(nodes[w].bb());
+      loop->set_is_reducible(ws_->type_[w] != BB_IRREDUCIBLE);
+      nodes[w].set_loop(loop);
+
+      for (; start < ws_->loop_ends_[i]; start++) {
+        UnionFindNode *node = &nodes[members[start]];
+
+        // Nested loops are not added, but linked together.
+        if (node->loop())
+          node->loop()->set_parent(loop);
+        else
+          loop->AddNode(node->bb());
+      }
+
+      lsg_->AddLoop(loop);
+    }
+  }  // BuildLoops
 
  private:
+  // Charge the time and counts since the last phase boundary to
+  // phase.
+  //
+  void Charge(FindLoopsStats::Phase phase) {
+    ws_->stats_.Charge(phase, &start_, pc_, counts_);
+  }
+
   MaoCFG             *CFG_;      // current control flow graph.
   LoopStructureGraph *lsg_;      // loop forest.
+  HavlakWorkspace    *ws_;       // scratch state.
+
+  // Phase clock for the current FindLoops.
+  PerfCounters       *pc_;       // counters, or NULL if not counting.
+  double              start_;    // time of the last phase boundary.
+  uint64_t            counts_[PerfCounters::NCounter];
 };  // HavlakLoopFinder
 
 
@@ -706,12 +1233,67 @@ const int HavlakLoopFinder::kUnvisited;
 const int HavlakLoopFinder::kMaxNonBackPreds;
 
 // External entry point.
-int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
-  HavlakLoopFinder finder(CFG, LSG);
+int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG,
+                    HavlakWorkspace *workspace) {
+  HavlakLoopFinder finder(CFG, LSG, workspace);
   finder.FindLoops();
   return LSG->GetNumLoops();
 }
 
+int FindHavlakLoops(MaoCFG *CFG, LoopStructureGraph *LSG) {
+  HavlakWorkspace workspace;
+  return FindHavlakLoops(CFG, LSG, &workspace);
+}
+
+//
+// FindHavlakLoopsBatch
+//
+// Analyse CFGs[i] into LSGs[i] for every i < n, on num_threads
+// threads that balance the load by stealing CFGs from each other.
+// Each thread reuses one workspace from 'workspaces', which is
+// grown to num_threads entries and can be kept for later batches.
+//
+void FindHavlakLoopsBatch(MaoCFG **CFGs, LoopStructureGraph **LSGs, int n,
+                          int num_threads,
+                          std::vector<HavlakWorkspace> *workspaces) {
+  if (num_threads < 1) num_threads = 1;
+  if (workspaces->size() < static_cast<size_t>(num_threads))
+    workspaces->resize(num_threads);
+  HavlakWorkspace *ws = &(*workspaces)[0];
+  ParallelFor(n, num_threads, [=](int worker, int i) {
+    FindHavlakLoops(CFGs[i], LSGs[i], &ws[worker]);
+  });
+}
+
+//
+// WriteCFG
+//
+// Write 'cfg' to 'file' in the binary CFG format of cfgfile.h,
+// numbering blocks by id, so that the start node is block 0.
+// Returns false on error.
+//
+bool WriteCFG(MaoCFG *cfg, const char *file) {
+  typedef std::vector<int> IntVector;
+
+  MaoCFG::NodeMap *blocks = cfg->GetBasicBlocks();
+  int size = blocks->size();
+  IntVector in_off(size + 1), in;
+  IntVector out_off(size + 1), out;
+  for (int i = 0; i < size; i++) {
+    BasicBlock *bb = (*blocks)[i];
+    for (BasicBlock::EdgeVector::iterator it = bb->in_edges()->begin();
+         it != bb->in_edges()->end(); ++it)
+      in.push_back((*it)->id());
+    for (BasicBlock::EdgeVector::iterator it = bb->out_edges()->begin();
+         it != bb->out_edges()->end(); ++it)
+      out.push_back((*it)->id());
+    in_off[i + 1] = in.size();
+    out_off[i + 1] = out.size();
+  }
+  return WriteCFGFile(file, size, in.size(), in_off.data(), in.data(),
+                      out_off.data(), out.data());
+}
+
 
 int buildDiamond(MaoCFG *cfg, int start) {
   int bb0 = start;
@@ -751,48 +1333,322 @@ int buildBaseLoop(MaoCFG *cfg, int from) {
 }
 
 
-int main(int argc, char *argv[]) {
-  MaoCFG cfg;
-  LoopStructureGraph lsg;
+//
+// Allocation counting, so that main can check that analysis with
+// a warm HavlakWorkspace never touches the heap, and report where
+// allocation happens. Counts are per thread, so batch analysis
+// does not race on them. With -memprofile, allocations are also
+// sampled into a heap profile.
+//
+static thread_local int64_t num_allocations = 0;
+
+// The replacements are kept out of line: inlined, they would show
+// the compiler malloc and free paired with new and delete, which
+// -Wall reports as mismatched although they match each other.
+__attribute__((noinline)) void *operator new(size_t size) {
+  num_allocations++;
+  alloc_counts[alloc_phase].count++;
+  alloc_counts[alloc_phase].bytes += size;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  MemProfileAlloc(p, size);
+  return p;
+}
 
-  cfg.CreateNode(0);  // top
-  buildBaseLoop(&cfg, 0);
-  cfg.CreateNode(1);  // bottom
-  new BasicBlockEdge(&cfg, 0,  2);
+__attribute__((noinline)) void operator delete(void *p) throw() {
+  MemProfileFree(p);
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) throw() {
+  MemProfileFree(p);
+  free(p);
+}
+
+static void PrintAllocCounts() {
+  for (int i = 0; i < kNumPhases; i++)
+    fprintf(stderr, "allocs: %-18s %10lld %14lld bytes\n", kPhaseNames[i],
+            static_cast<long long>(alloc_counts[i].count),
+            static_cast<long long>(alloc_counts[i].bytes));
+}
+
+//
+// ReadCFG adds the blocks and edges of a CFG file, as written by
+// WriteCFG, to an empty cfg. It reads the whole file anyway, so
+// it always checks it.
+//
+bool ReadCFG(MaoCFG *cfg, const char *file) {
+  size_t size;
+  const CFGFileHeader *h = MapCFGFile(file, &size);
+  if (!h) return false;
+  if (!CheckCFGFile(file, h)) {
+    munmap(const_cast<CFGFileHeader *>(h), size);
+    return false;
+  }
+  const int32_t *out_off = reinterpret_cast<const int32_t *>(h + 1) +
+                           h->nblock + 1 + h->nedge;
+  const int32_t *out = out_off + h->nblock + 1;
+  int nblock = h->nblock;
+  for (int i = 0; i < nblock; i++)
+    cfg->CreateNode(i);
+  for (int i = 0; i < nblock; i++)
+    for (int j = out_off[i]; j < out_off[i + 1]; j++)
+      new BasicBlockEdge(cfg, i, out[j]);
+  munmap(const_cast<CFGFileHeader *>(h), size);
+  return true;
+}
+
+//
+// BuildDefaultCFG builds the benchmark's standard graph, running
+// 'warmup' analyses of its first few blocks along the way.
+//
+void BuildDefaultCFG(MaoCFG *cfg, HavlakWorkspace *workspace, int warmup) {
+  cfg->CreateNode(0);  // top
+  buildBaseLoop(cfg, 0);
+  cfg->CreateNode(1);  // bottom
+  new BasicBlockEdge(cfg, 0,  2);
 
-  for (int dummyloops = 0; dummyloops < 15000; ++dummyloops) {
+  for (int dummyloops = 0; dummyloops < warmup; ++dummyloops) {
     LoopStructureGraph * lsglocal = new LoopStructureGraph();
-    FindHavlakLoops(&cfg, lsglocal);
+    FindHavlakLoops(cfg, lsglocal, workspace);
     delete(lsglocal);
   }
 
   int n = 2;
 
   for (int parlooptrees = 0; parlooptrees < 10; parlooptrees++) {
-    cfg.CreateNode(n + 1);
-    buildConnect(&cfg, 2, n + 1);
+    cfg->CreateNode(n + 1);
+    buildConnect(cfg, 2, n + 1);
     n = n + 1;
 
     for (int i = 0; i < 100; i++) {
       int top = n;
-      n = buildStraight(&cfg, n, 1);
+      n = buildStraight(cfg, n, 1);
       for (int j = 0; j < 25; j++) {
-        n = buildBaseLoop(&cfg, n);
+        n = buildBaseLoop(cfg, n);
       }
-      int bottom = buildStraight(&cfg, n, 1);
-      buildConnect(&cfg, n, top);
+      int bottom = buildStraight(cfg, n, 1);
+      buildConnect(cfg, n, top);
       n = bottom;
     }
-    buildConnect(&cfg, n, 1);
+    buildConnect(cfg, n, 1);
   }
+}
+
+int main(int argc, char *argv[]) {
+  const char *write_file = NULL;
+  const char *load_file = NULL;
+  const char *canon_file = NULL;
+  const char *cpu_profile = NULL;
+  const char *mem_profile = NULL;
+  const char *gen_family = NULL;
+  const char *engine = "havlak";
+  const char *format = "text";
+  int gen_blocks = 100000;
+  int gen_edges = 0;
+  uint64_t seed = 1;
+  int warmup = -1;  // 15000 for the default graph, else 1
+  int iterations = 50;
+  int num_threads = 1;
+  bool counters = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-counters") == 0) {
+      counters = true;
+      continue;
+    }
+    if (strncmp(argv[i], "-cpuprofile=", 12) == 0) {
+      cpu_profile = argv[i] + 12;
+      continue;
+    }
+    if (strncmp(argv[i], "-memprofile=", 12) == 0) {
+      mem_profile = argv[i] + 12;
+      continue;
+    }
+    if (strncmp(argv[i], "-write=", 7) == 0) {
+      write_file = argv[i] + 7;
+      continue;
+    }
+    if (strncmp(argv[i], "-load=", 6) == 0) {
+      load_file = argv[i] + 6;
+      continue;
+    }
+    if (strncmp(argv[i], "-canon=", 7) == 0) {
+      canon_file = argv[i] + 7;
+      continue;
+    }
+    if (strncmp(argv[i], "-gen=", 5) == 0) {
+      gen_family = argv[i] + 5;
+      continue;
+    }
+    if (strncmp(argv[i], "-blocks=", 8) == 0) {
+      gen_blocks = atoi(argv[i] + 8);
+      continue;
+    }
+    if (strncmp(argv[i], "-nedge=", 7) == 0) {
+      gen_edges = atoi(argv[i] + 7);
+      continue;
+    }
+    if (strncmp(argv[i], "-seed=", 6) == 0) {
+      seed = strtoull(argv[i] + 6, NULL, 0);
+      continue;
+    }
+    if (strncmp(argv[i], "-engine=", 8) == 0) {
+      engine = argv[i] + 8;
+      continue;
+    }
+    if (strncmp(argv[i], "-format=", 8) == 0) {
+      format = argv[i] + 8;
+      continue;
+    }
+    if (strncmp(argv[i], "-warmup=", 8) == 0) {
+      warmup = atoi(argv[i] + 8);
+      continue;
+    }
+    if (strncmp(argv[i], "-iterations=", 12) == 0) {
+      iterations = atoi(argv[i] + 12);
+      continue;
+    }
+    if (strncmp(argv[i], "-threads=", 9) == 0) {
+      num_threads = atoi(argv[i] + 9);
+      continue;
+    }
+    fprintf(stderr, "usage: havlak1cc [-blocks=n] [-canon=file] [-counters] "
+            "[-cpuprofile=file] "
+            "[-engine=havlak] [-format=text|json|csv] [-gen=family] "
+            "[-iterations=n] [-load=file] [-memprofile=file] [-nedge=n] "
+            "[-seed=n] [-threads=n] [-warmup=n] [-write=file]\n");
+    fprintf(stderr, "families: %s\n", GenFamilies);
+    return 2;
+  }
+  if (strcmp(engine, "havlak") != 0) {
+    fprintf(stderr, "unknown engine %s; want havlak\n", engine);
+    return 2;
+  }
+  if (!BenchFormatOK(format)) {
+    fprintf(stderr, "unknown format %s; want text, json or csv\n", format);
+    return 2;
+  }
+  if (num_threads < 1) num_threads = 1;
+  if (iterations < 1) iterations = 1;
+  if (warmup < 0) warmup = (load_file || gen_family) ? 1 : 15000;
+
+  if (cpu_profile) {
+    if (!StartCPUProfile(cpu_profile))
+      return 1;
+    atexit([]() { StopCPUProfile(); });
+  }
+  if (mem_profile)
+    StartMemProfile(mem_profile);
 
-  int num_loops = FindHavlakLoops(&cfg, &lsg);
+  MaoCFG cfg(MaoCFG::kDenseNames);
+  LoopStructureGraph lsg;
+  HavlakWorkspace workspace;
+  char graph[256];
+
+  if (load_file) {
+    if (!ReadCFG(&cfg, load_file))
+      return 1;
+    snprintf(graph, sizeof graph, "load:%s", load_file);
+  } else if (gen_family) {
+    std::vector<int> src, dst;
+    int n = GenCFG(gen_family, gen_blocks, gen_edges, seed, &src, &dst);
+    if (n < 0) {
+      fprintf(stderr, "unknown family %s; want one of %s\n", gen_family,
+              GenFamilies);
+      return 2;
+    }
+    for (int i = 0; i < n; i++)
+      cfg.CreateNode(i);
+    for (size_t i = 0; i < src.size(); i++)
+      new BasicBlockEdge(&cfg, src[i], dst[i]);
+    snprintf(graph, sizeof graph, "gen:%s:%d:%d:%llu", gen_family, n,
+             static_cast<int>(src.size()),
+             static_cast<unsigned long long>(seed));
+  } else {
+    BuildDefaultCFG(&cfg, &workspace, warmup);
+    snprintf(graph, sizeof graph, "default");
+  }
+  if (write_file && !WriteCFG(&cfg, write_file))
+    return 1;
+
+  int num_loops = FindHavlakLoops(&cfg, &lsg, &workspace);
+  if (canon_file && !lsg.WriteCanon(canon_file))
+    return 1;
+
+  // The workspace has now seen the full CFG, so analysing it again
+  // must not allocate; only building the loop forest may.
+  {
+    LoopStructureGraph lsglocal;
+    HavlakLoopFinder finder(&cfg, &lsglocal, &workspace);
+    int64_t allocations = num_allocations;
+    finder.Analyze();
+    if (num_allocations != allocations) {
+      fprintf(stderr, "steady-state analysis made %lld allocations\n",
+              static_cast<long long>(num_allocations - allocations));
+      return 1;
+    }
+  }
+
+  // Generated and loaded graphs are warmed up on the graph itself;
+  // the default graph was warmed up while it was being built.
+  if (load_file || gen_family) {
+    for (int i = 0; i < warmup; i++) {
+      LoopStructureGraph lsg;
+      FindHavlakLoops(&cfg, &lsg, &workspace);
+    }
+  }
 
+  // Each iteration analyses num_threads copies of the CFG at once.
+  // Phase statistics cover only these timed iterations.
+  std::vector<HavlakWorkspace> workspaces(num_threads);
+  workspace.stats()->Reset();
+  workspace.set_counters(counters);
+  for (int j = 0; j < num_threads; j++)
+    workspaces[j].set_counters(counters);
+  std::vector<MaoCFG *> cfgs(num_threads, &cfg);
+  std::vector<LoopStructureGraph *> lsgs(num_threads);
+  std::vector<double> times;
   int sum = 0;
-  for (int i = 0; i < 50; i++) {
-    LoopStructureGraph lsg;
-    sum += FindHavlakLoops(&cfg, &lsg);
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < num_threads; j++)
+      lsgs[j] = new LoopStructureGraph();
+    double t0 = Now();
+    if (num_threads == 1)
+      FindHavlakLoops(cfgs[0], lsgs[0], &workspace);
+    else
+      FindHavlakLoopsBatch(&cfgs[0], &lsgs[0], num_threads, num_threads,
+                           &workspaces);
+    times.push_back(Now() - t0);
+    sum += lsgs[0]->GetNumLoops();
+    for (int j = 0; j < num_threads; j++)
+      delete lsgs[j];
   }
+
+  bool text = strcmp(format, "text") == 0;
   fprintf(stderr, "# of loops: %d (total %d)\n", num_loops, sum);
-  lsg.Dump();
+  if (text)
+    lsg.Dump();
+  long long num_edges = 0;
+  for (int i = 0; i < cfg.GetNumNodes(); i++)
+    num_edges += (*cfg.GetBasicBlocks())[i]->out_edges()->size();
+  BenchInfo info = {"havlak1cc", engine, graph, cfg.GetNumNodes(), num_edges,
+                    num_loops, num_threads, warmup};
+  BenchReport(stdout, format, info, times);
+
+  if (counters) {
+    FindLoopsStats stats = *workspace.stats();
+    for (int j = 0; j < num_threads; j++)
+      stats.Add(*workspaces[j].stats());
+    if (stats.counted() == 0)
+      fprintf(stderr, "hardware counters unavailable; timing only\n");
+    stats.Print(stderr);
+  }
+
+  // Write the heap profile while the CFG and loop forest are
+  // still live, so that it shows what they hold on to.
+  if (mem_profile) {
+    PrintAllocCounts();
+    if (!StopMemProfile())
+      return 1;
+  }
 }
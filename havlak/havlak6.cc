@@ -1,17 +1,36 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <algorithm>
+#include <charconv>
+#include <deque>
 #include <string>
 #include <vector>
 
+#include "bench.h"
+#include "canon.h"
+#include "cfgfile.h"
+#include "cfggen.h"
+#include "perfcount.h"
+#include "profile.h"
+#include "workpool.h"
+
 using namespace std;
 
 class Block {
 public:
-	Block(int n) : name(n) {}
+	Block(int n) : name(n), dead(false) {}
 
 	int name;
+	bool dead;	// killed, awaiting CFG::Compact
 	vector<Block*> in;
 	vector<Block*> out;
+	vector<int> outEdge;	// index in CFG::edge of each out edge
 
 	string String();
 	void Dump(FILE*);
@@ -35,22 +54,43 @@ void Block::Dump(FILE *f) {
 
 struct Edge {
 	Edge(int s, int d) : src(s), dst(d) {}
-	int src, dst;
+	int src, dst;	// src is -1 for a removed edge
 };
 
+// A CFG can shrink as well as grow. Disconnect and Kill leave
+// tombstones, so that block names and edge indexes stay put: a
+// removed edge stays in edge with src -1 until there are more
+// removed edges than live ones, and a killed block stays in block,
+// without edges, until Compact renames the live blocks in order.
+
 class CFG {
 public:
 	vector<Block*> block;
-	vector<Edge> edge;
+	vector<Edge> edge;	// in the order added
+	int ndeadBlock;
+	int ndeadEdge;
+
+	CFG() : ndeadBlock(0), ndeadEdge(0) {}
+	~CFG();
 
 	Block *NewBlock();
 	void Connect(Block *src, Block *dst);
+	bool Disconnect(Block *src, Block *dst);
+	bool Kill(Block *b);
+	void Compact();
 	Block *Path(Block *from);
 	Block *Diamond(Block *from);
 	Block *BaseLoop(Block *from);
+	Block *WideLoop(Block *from, int width);
+	Block *DeepLoop(Block *from, int depth);
 	void Dump(FILE*);
 };
 
+CFG::~CFG() {
+	for (int i = 0; i < this->block.size(); i++)
+		delete this->block[i];
+}
+
 Block *CFG::NewBlock() {
 	Block *b = new Block(this->block.size());
 	this->block.push_back(b);
@@ -64,10 +104,92 @@ void CFG::Dump(FILE *f) {
 
 void CFG::Connect(Block *src, Block *dst) {
 	src->out.push_back(dst);
+	src->outEdge.push_back(this->edge.size());
 	dst->in.push_back(src);
 	this->edge.push_back(Edge(src->name, dst->name));
 }
 
+// Disconnect removes the last edge from src to dst, keeping the
+// order of the others, and reports whether there was one.
+
+bool CFG::Disconnect(Block *src, Block *dst) {
+	int i = src->out.size() - 1;
+	while (i >= 0 && src->out[i] != dst)
+		i--;
+	if (i < 0)
+		return false;
+	this->edge[src->outEdge[i]].src = -1;
+	src->out.erase(src->out.begin() + i);
+	src->outEdge.erase(src->outEdge.begin() + i);
+	int j = dst->in.size() - 1;
+	while (dst->in[j] != src)
+		j--;
+	dst->in.erase(dst->in.begin() + j);
+
+	// Drop the removed edges once they are the majority.
+	if (++this->ndeadEdge > this->edge.size() / 2) {
+		vector<int> index(this->edge.size());
+		int k = 0;
+		for (int e = 0; e < this->edge.size(); e++) {
+			if (this->edge[e].src < 0)
+				continue;
+			index[e] = k;
+			this->edge[k++] = this->edge[e];
+		}
+		this->edge.erase(this->edge.begin() + k, this->edge.end());
+		for (int b = 0; b < this->block.size(); b++) {
+			vector<int> &oe = this->block[b]->outEdge;
+			for (int e = 0; e < oe.size(); e++)
+				oe[e] = index[oe[e]];
+		}
+		this->ndeadEdge = 0;
+	}
+	return true;
+}
+
+// Kill removes b's edges and marks it dead. It reports whether
+// it did: the entry block cannot be killed.
+
+bool CFG::Kill(Block *b) {
+	if (b == this->block[0])
+		return false;
+	while (!b->out.empty())
+		this->Disconnect(b, b->out.back());
+	while (!b->in.empty())
+		this->Disconnect(b->in.back(), b);
+	b->dead = true;
+	this->ndeadBlock++;
+	return true;
+}
+
+// Compact deletes the killed blocks and renames the others in
+// order. Pointers to live blocks stay valid.
+
+void CFG::Compact() {
+	if (this->ndeadBlock == 0)
+		return;
+	vector<int> name(this->block.size());
+	int k = 0;
+	for (int i = 0; i < this->block.size(); i++) {
+		Block *b = this->block[i];
+		if (b->dead) {
+			delete b;
+			continue;
+		}
+		name[i] = k;
+		b->name = k;
+		this->block[k++] = b;
+	}
+	this->block.resize(k);
+	for (int e = 0; e < this->edge.size(); e++) {
+		if (this->edge[e].src < 0)
+			continue;
+		this->edge[e].src = name[this->edge[e].src];
+		this->edge[e].dst = name[this->edge[e].dst];
+	}
+	this->ndeadBlock = 0;
+}
+
 Block *CFG::Path(Block *from) {
 	Block *n = this->NewBlock();
 	this->Connect(from, n);
@@ -89,7 +211,54 @@ Block *CFG::BaseLoop(Block *from) {
 	return this->Path(z);
 }
 
-CFG *BuildGraph() {
+// WideLoop builds a loop whose header branches to width
+// separate blocks that all rejoin at a single latch.
+
+Block *CFG::WideLoop(Block *from, int width) {
+	Block *head = this->Path(from);
+	Block *latch = this->NewBlock();
+	for (int i = 0; i < width; i++)
+		this->Connect(this->Path(head), latch);
+	this->Connect(latch, head);
+	return this->Path(latch);
+}
+
+// DeepLoop builds depth loops, each nested inside the next.
+
+Block *CFG::DeepLoop(Block *from, int depth) {
+	vector<Block*> head;
+	for (int i = 0; i < depth; i++) {
+		from = this->Path(from);
+		head.push_back(from);
+	}
+	for (int i = depth-1; i >= 0; i--) {
+		Block *latch = this->Path(from);
+		this->Connect(latch, head[i]);
+		from = this->Path(latch);
+	}
+	return from;
+}
+
+CFG *BuildWideGraph(int width) {
+	CFG *g = new CFG;
+	Block *n = g->NewBlock();
+	n = g->WideLoop(n, width);
+	g->Path(n);
+	return g;
+}
+
+CFG *BuildDeepGraph(int depth) {
+	CFG *g = new CFG;
+	Block *n = g->NewBlock();
+	n = g->DeepLoop(n, depth);
+	g->Path(n);
+	return g;
+}
+
+// BuildLoopTrees builds ntree parallel trees, each a sequence of
+// nloop loops containing a sequence of nbase base loops.
+
+CFG *BuildLoopTrees(int ntree, int nloop, int nbase) {
 	CFG *g = new CFG;
 	
 	Block *n0 = g->NewBlock();
@@ -97,14 +266,14 @@ CFG *BuildGraph() {
 	Block *n2 = g->NewBlock();
 	g->Connect(n0, n2);
 	
-	for (int i = 0; i < 10; i++) {
+	for (int i = 0; i < ntree; i++) {
 		Block *n = g->NewBlock();
 		g->Connect(n2, n);
 
-		for (int j = 0; j < 100; j++) {
+		for (int j = 0; j < nloop; j++) {
 			Block *top = n;
 			n = g->Path(n);
-			for (int k = 0; k < 25; k++) {
+			for (int k = 0; k < nbase; k++) {
 				n = g->BaseLoop(n);
 			}
 			Block *bottom = g->Path(n);
@@ -116,286 +285,3057 @@ CFG *BuildGraph() {
 	return g;
 }
 
-// Basic representation of loop graph.
+CFG *BuildGraph() {
+	return BuildLoopTrees(10, 100, 25);
+}
 
-class Loop {
+// Frozen control flow graph, in compressed sparse row form.
+// Blocks are named by number; the predecessors of block b are
+// in[inOff[b]] through in[inOff[b+1]-1], and likewise for out.
+// Keeping all the edges in two contiguous arrays avoids chasing
+// a pointer per block during loop finding.
+//
+// The arrays point either into the buffers below, for graphs
+// built in memory, or into a mapped CFG file (see cfgfile.h),
+// which is then analysed in place.
+
+class FrozenCFG {
 public:
-	vector<Block*> block;
-	vector<Loop*> child;
-	Loop *parent;
-	Block *head;
-	
-	bool isRoot;
-	bool isReducible;
-	int counter;
-	int nesting;
-	int depth;
+	int nblock;
+	int nedge;
+	const int *inOff;
+	const int *in;
+	const int *outOff;
+	const int *out;
 
+	vector<int> inOffBuf;
+	vector<int> inBuf;
+	vector<int> outOffBuf;
+	vector<int> outBuf;
+	void *mapped;
+	size_t mappedSize;
+
+	FrozenCFG();
+	FrozenCFG(const FrozenCFG&);
+	~FrozenCFG();
+	FrozenCFG &operator=(const FrozenCFG&);
+	void Freeze(CFG*);
+	void Build(int nblock, const int *src, const int *dst, int nedge, int nthread, bool dedup);
+	bool Load(const char *file, bool check);
+	bool Write(const char *file);
+	void Dump(FILE*);
+	void useBuffers();
+	void unmap();
 };
 
-class LoopGraph {
-public:
-	Loop root;
-	vector<Loop*> loop;
-	~LoopGraph();
+FrozenCFG::FrozenCFG() : mapped(NULL), mappedSize(0) {
+	this->useBuffers();
+}
 
-	Loop *NewLoop(int cap);
-	void CalculateNesting();
-	void calculateNesting(Loop* l, int depth);
-};
+FrozenCFG::FrozenCFG(const FrozenCFG &g) : mapped(NULL), mappedSize(0) {
+	*this = g;
+}
 
-LoopGraph::~LoopGraph() {
-	for (int i = 0; i < this->loop.size(); i++)
-		delete this->loop[i];
+FrozenCFG::~FrozenCFG() {
+	this->unmap();
 }
 
-static int loopCounter = 0;
+// Copies always use buffers, even when copying a mapped graph.
 
-Loop *LoopGraph::NewLoop(int cap) {
-	loopCounter++;
-	Loop *l = new Loop;
-	l->counter = loopCounter;
-	l->block.reserve(cap);
-	this->loop.push_back(l);
-	return l;
+FrozenCFG &FrozenCFG::operator=(const FrozenCFG &g) {
+	if (this == &g)
+		return *this;
+	this->inOffBuf.assign(g.inOff, g.inOff + g.nblock+1);
+	this->inBuf.assign(g.in, g.in + g.nedge);
+	this->outOffBuf.assign(g.outOff, g.outOff + g.nblock+1);
+	this->outBuf.assign(g.out, g.out + g.nedge);
+	this->useBuffers();
+	return *this;
 }
 
-void LoopGraph::CalculateNesting() {
-	for (int i = 0; i < this->loop.size(); i++) {
-		Loop *l = this->loop[i];
-		if (l->isRoot)
-			continue;
-		if (l->parent == NULL) {
-			l->parent = &this->root;
-			this->root.child.push_back(l);
+// useBuffers points the arrays at the buffers, which must
+// already hold a graph (or be empty).
+
+void FrozenCFG::useBuffers() {
+	this->unmap();
+	if (this->inOffBuf.empty())
+		this->inOffBuf.push_back(0);
+	if (this->outOffBuf.empty())
+		this->outOffBuf.push_back(0);
+	this->nblock = this->inOffBuf.size() - 1;
+	this->nedge = this->inBuf.size();
+	this->inOff = this->inOffBuf.data();
+	this->in = this->inBuf.data();
+	this->outOff = this->outOffBuf.data();
+	this->out = this->outBuf.data();
+}
+
+void FrozenCFG::unmap() {
+	if (this->mapped != NULL)
+		munmap(this->mapped, this->mappedSize);
+	this->mapped = NULL;
+	this->mappedSize = 0;
+}
+
+void FrozenCFG::Freeze(CFG *g) {
+	int n = g->block.size();
+	vector<int> &inOff = this->inOffBuf;
+	vector<int> &outOff = this->outOffBuf;
+	inOff.resize(n+1);
+	outOff.resize(n+1);
+	inOff[0] = 0;
+	outOff[0] = 0;
+	for (int i = 0; i < n; i++) {
+		Block *b = g->block[i];
+		inOff[i+1] = inOff[i] + b->in.size();
+		outOff[i+1] = outOff[i] + b->out.size();
+	}
+	this->inBuf.resize(inOff[n]);
+	this->outBuf.resize(outOff[n]);
+	for (int i = 0; i < n; i++) {
+		Block *b = g->block[i];
+		int *in = this->inBuf.data() + inOff[i];
+		for (int j = 0; j < b->in.size(); j++)
+			in[j] = b->in[j]->name;
+		int *out = this->outBuf.data() + outOff[i];
+		for (int j = 0; j < b->out.size(); j++)
+			out[j] = b->out[j]->name;
+	}
+	this->useBuffers();
+}
+
+// Load maps a CFG file and points the arrays into it, so that
+// the graph is used in place, without copying. The buffers are
+// freed. The offsets and block numbers are checked, since the loop
+// finders index by them; if check is set, Load also checks that the
+// predecessor and successor lists hold the same edges.
+
+bool FrozenCFG::Load(const char *file, bool check) {
+	size_t size;
+	const CFGFileHeader *h = MapCFGFile(file, &size);
+	if (h == NULL)
+		return false;
+	if (!CheckCFGFile(file, h) || (check && !CheckCFGEdges(file, h))) {
+		munmap((void*)h, size);
+		return false;
+	}
+	vector<int>().swap(this->inOffBuf);
+	vector<int>().swap(this->inBuf);
+	vector<int>().swap(this->outOffBuf);
+	vector<int>().swap(this->outBuf);
+	this->unmap();
+	this->mapped = (void*)h;
+	this->mappedSize = size;
+	this->nblock = h->nblock;
+	this->nedge = h->nedge;
+	this->inOff = (const int*)(h+1);
+	this->in = this->inOff + this->nblock+1;
+	this->outOff = this->in + this->nedge;
+	this->out = this->outOff + this->nblock+1;
+	return true;
+}
+
+bool FrozenCFG::Write(const char *file) {
+	return WriteCFGFile(file, this->nblock, this->nedge, this->inOff, this->in, this->outOff, this->out);
+}
+
+// Bulk construction from edge arrays.
+//
+// scatter sets off and adj to the compressed rows of the edges
+// from[i] -> to[i], grouped by from[i] and in edge order within
+// each group. The blocks are split into nchunk ranges and the
+// edges into nchunk chunks, handled in parallel. First each chunk
+// counts its edges per range and copies them, in order, into its
+// slot of each range's bucket; then each range lays out the rows
+// of its blocks from its bucket. Working memory is thus the edges
+// once more and the rows of one range per thread, however many
+// threads there are.
+
+static void scatter(int nblock, const int *from, const int *to, int nedge, int nchunk, vector<int> *off, vector<int> *adj) {
+	off->assign(nblock+1, 0);
+	adj->resize(nedge);
+	if (nblock == 0)
+		return;
+	int span = (nblock + nchunk-1) / nchunk;
+	int nrange = (nblock + span-1) / span;
+
+	// With one range, the edges are already its bucket.
+	const int *bf = from;
+	const int *bt = to;
+	vector<int> start(2);
+	start[1] = nedge;
+	vector<int> bfrom, bto;
+	if (nrange > 1) {
+		vector<int> count((size_t)nchunk * nrange);	// by chunk, then range
+		ParallelFor(nchunk, nchunk, [&](int, int c) {
+			int *cnt = &count[(size_t)c * nrange];
+			int hi = (long long)nedge * (c+1) / nchunk;
+			for (int i = (long long)nedge * c / nchunk; i < hi; i++) {
+				assert(0 <= from[i] && from[i] < nblock);
+				cnt[from[i] / span]++;
+			}
+		});
+
+		// Turn the counts into each chunk's slot in each bucket,
+		// the buckets in range order, so that bucket r starts at
+		// start[r] and the edges stay in order within it.
+		start.resize(nrange+1);
+		int sum = 0;
+		for (int r = 0; r < nrange; r++) {
+			start[r] = sum;
+			for (int c = 0; c < nchunk; c++) {
+				int n = count[(size_t)c * nrange + r];
+				count[(size_t)c * nrange + r] = sum;
+				sum += n;
+			}
+		}
+		start[nrange] = sum;
+
+		bfrom.resize(nedge);
+		bto.resize(nedge);
+		ParallelFor(nchunk, nchunk, [&](int, int c) {
+			int *cnt = &count[(size_t)c * nrange];
+			int hi = (long long)nedge * (c+1) / nchunk;
+			for (int i = (long long)nedge * c / nchunk; i < hi; i++) {
+				int k = cnt[from[i] / span]++;
+				bfrom[k] = from[i];
+				bto[k] = to[i];
+			}
+		});
+		bf = bfrom.data();
+		bt = bto.data();
+	}
+
+	int *o = off->data();
+	int *a = adj->data();
+	ParallelFor(nrange, nchunk, [&](int, int r) {
+		int lo = r * span;
+		int hi = min(nblock, lo + span);
+		vector<int> next(hi - lo + 1);
+		for (int i = start[r]; i < start[r+1]; i++) {
+			assert(lo <= bf[i] && bf[i] < hi && 0 <= bt[i] && bt[i] < nblock);
+			next[bf[i] - lo + 1]++;
+		}
+		next[0] = start[r];
+		for (int b = lo; b < hi; b++) {
+			next[b-lo+1] += next[b-lo];
+			o[b+1] = next[b-lo+1];
+		}
+		for (int i = start[r]; i < start[r+1]; i++)
+			a[next[bf[i] - lo]++] = bt[i];
+	});
+}
+
+// dedup removes repeated entries from each row of off and adj,
+// keeping the first of each. Short rows are searched directly;
+// longer ones are sorted, with their positions, in a scratch
+// array of the worker's, which is never longer than the row.
+
+static void dedup(int nblock, int nchunk, vector<int> *off, vector<int> *adj) {
+	vector<int> deg(nblock+1);
+	int *o = off->data();
+	int *a = adj->data();
+	vector<vector<pair<int, int> > > scratch(nchunk);
+	ParallelFor(nchunk, nchunk, [&](int w, int c) {
+		vector<pair<int, int> > &s = scratch[w];
+		int hi = (long long)nblock * (c+1) / nchunk;
+		for (int b = (long long)nblock * c / nchunk; b < hi; b++) {
+			int *row = a + o[b];
+			int n = o[b+1] - o[b];
+			int k = 0;
+			if (n <= 32) {
+				for (int i = 0; i < n; i++) {
+					int j = 0;
+					while (j < k && row[j] != row[i])
+						j++;
+					if (j == k)
+						row[k++] = row[i];
+				}
+			} else {
+				s.resize(n);
+				for (int i = 0; i < n; i++)
+					s[i] = make_pair(row[i], i);
+				sort(s.begin(), s.end());
+				for (int i = 1; i < n; i++)
+					if (s[i].first == s[i-1].first)
+						row[s[i].second] = -1;
+				for (int i = 0; i < n; i++)
+					if (row[i] >= 0)
+						row[k++] = row[i];
+			}
+			deg[b+1] = k;
 		}
+	});
+	for (int b = 0; b < nblock; b++)
+		deg[b+1] += deg[b];
+
+	vector<int> nadj(deg[nblock]);
+	int *na = nadj.data();
+	ParallelFor(nchunk, nchunk, [&](int, int c) {
+		int hi = (long long)nblock * (c+1) / nchunk;
+		for (int b = (long long)nblock * c / nchunk; b < hi; b++)
+			copy(a + o[b], a + o[b] + deg[b+1] - deg[b], na + deg[b]);
+	});
+	off->swap(deg);
+	adj->swap(nadj);
+}
+
+// Build sets g to the graph with blocks 0 through nblock-1 and
+// the edges src[i] -> dst[i], using nthread threads. Edges appear
+// in the in and out lists in the order given, so Build produces
+// the same graph as Connecting the edges in order and freezing.
+// If dedup is set, repeated edges are dropped. Every src[i] and
+// dst[i] must be a block, in [0, nblock).
+
+void FrozenCFG::Build(int nblock, const int *src, const int *dst, int nedge, int nthread, bool dedup) {
+	if (nthread < 1)
+		nthread = 1;
+	if (nblock <= 0) {
+		this->inOffBuf.clear();
+		this->inBuf.clear();
+		this->outOffBuf.clear();
+		this->outBuf.clear();
+		this->useBuffers();
+		return;
+	}
+	scatter(nblock, src, dst, nedge, nthread, &this->outOffBuf, &this->outBuf);
+	scatter(nblock, dst, src, nedge, nthread, &this->inOffBuf, &this->inBuf);
+	if (dedup) {
+		::dedup(nblock, nthread, &this->outOffBuf, &this->outBuf);
+		::dedup(nblock, nthread, &this->inOffBuf, &this->inBuf);
 	}
-	this->calculateNesting(&this->root, 0);
+	this->useBuffers();
 }
 
-void LoopGraph::calculateNesting(Loop *l, int depth) {
-	l->depth = depth;
-	for (int i = 0; i < l->child.size(); i++) {
-		Loop *child = l->child[i];
-		this->calculateNesting(child, depth+1);
-		int n = child->nesting + 1;
-		if (l->nesting < n)
-			l->nesting = n;
+void FrozenCFG::Dump(FILE *f) {
+	for (int b = 0; b < this->nblock; b++) {
+		fprintf(f, "b%d: [", b);
+		for (int i = this->inOff[b]; i < this->inOff[b+1]; i++)
+			fprintf(f, "%sb%d", i > this->inOff[b] ? " " : "", this->in[i]);
+		fprintf(f, "] [");
+		for (int i = this->outOff[b]; i < this->outOff[b+1]; i++)
+			fprintf(f, "%sb%d", i > this->outOff[b] ? " " : "", this->out[i]);
+		fprintf(f, "]\n");
 	}
 }
 
-// TODO: Dump, String
+// Reading CFGs from text edge lists.
+//
+// An edge list has one edge per line, written as two block numbers
+// "src dst". A file can hold many functions: a line that does not
+// start with a digit begins a new function, and its text is the
+// function's name. Blank lines are ignored. Each function is a
+// separate CFG whose entry is block 0.
+//
+// EdgeListReader reads the file one fixed-size chunk at a time,
+// splits each chunk's complete lines among nthread threads to
+// parse, and builds each function with FrozenCFG::Build.
 
-// Loop finding state, generated or reused on each iteration.
+struct EdgeListPart {
+	vector<int> src;
+	vector<int> dst;
+	vector<int> headAt;	// number of edges before each header
+	vector<string> head;
+	int nline;
+	int bad;	// first malformed line, or -1
+};
 
-class LoopBlock {
+static const char *skipBlank(const char *p, const char *e) {
+	while (p < e && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+// parseEdges parses the complete lines in [p, e) into part.
+
+static void parseEdges(const char *p, const char *e, EdgeListPart *part) {
+	part->src.clear();
+	part->dst.clear();
+	part->headAt.clear();
+	part->head.clear();
+	part->nline = 0;
+	part->bad = -1;
+	while (p < e) {
+		const char *end = (const char*)memchr(p, '\n', e - p);
+		if (end == NULL)
+			end = e;
+		const char *q = skipBlank(p, end);
+		if (q < end && (*q < '0' || *q > '9')) {
+			const char *t = end;
+			while (t > q && (t[-1] == '\r' || t[-1] == ' ' || t[-1] == '\t'))
+				t--;
+			part->headAt.push_back(part->src.size());
+			part->head.push_back(string(q, t));
+		} else if (q < end) {
+			int src, dst;
+			from_chars_result r = from_chars(q, end, src);
+			const char *d = skipBlank(r.ptr, end);
+			from_chars_result s = from_chars(d, end, dst);
+			// Block numbers must leave room for the block count.
+			if (r.ec != errc() || d == r.ptr || s.ec != errc() || dst < 0 ||
+			    src == INT_MAX || dst == INT_MAX || skipBlank(s.ptr, end) != end) {
+				if (part->bad < 0)
+					part->bad = part->nline;
+			} else {
+				part->src.push_back(src);
+				part->dst.push_back(dst);
+			}
+		}
+		part->nline++;
+		p = end + 1;
+	}
+}
+
+class EdgeListReader {
 public:
-	enum Type {
-		NonHeader,
-		Reducible,
-		Self,
-		Irreducible,
-		Dead,
+	EdgeListReader(FILE *f, const char *file, int nthread, int chunk);
+	bool Next(FrozenCFG *g, string *name);
+
+	bool failed;
+
+private:
+	struct Function {
+		Function() : started(false), nblock(0) {}
+		bool started;
+		string name;
+		int nblock;
+		vector<int> src;
+		vector<int> dst;
 	};
 
-	Block *block;
-	Loop *loop;
-	int first;
-	int last;
-	LoopBlock *header; // TODO: head
-	Type type;
-	vector<LoopBlock*> backPred;
-	vector<LoopBlock*> nonBackPred;
-	LoopBlock *unionf;
+	FILE *f;
+	const char *file;
+	int nthread;
+	vector<char> buf;
+	int carry;
+	bool eof;
+	long long line;
+	vector<EdgeListPart> part;
+	Function cur;
+	deque<Function> done;
 
-	void Init(Block*);
-	LoopBlock *Find();
-	bool IsAncestor(LoopBlock*);
-	
+	void fill();
+	void endFunction();
 };
 
-class LoopFinder {
-public:
-	vector<LoopBlock> loopBlock;
-	vector<LoopBlock*> depthFirst;
-	vector<LoopBlock*> pool;
+EdgeListReader::EdgeListReader(FILE *f, const char *file, int nthread, int chunk)
+	: failed(false), f(f), file(file), nthread(nthread < 1 ? 1 : nthread),
+	  buf(chunk), carry(0), eof(false), line(0), part(this->nthread) {
+}
 
-	void Search(Block*);
-	void FindLoops(CFG*, LoopGraph*);
+void EdgeListReader::endFunction() {
+	if (this->cur.started)
+		this->done.push_back(this->cur);
+	this->cur = Function();
+}
+
+// fill reads the next chunk and parses its complete lines.
+// Any partial last line is kept for the next call.
+
+void EdgeListReader::fill() {
+	char *buf = &this->buf[0];
+	int size = this->buf.size();
+	int n = fread(buf + this->carry, 1, size - this->carry, this->f);
+	int len = this->carry + n;
+	int end = len;
+	if (n < size - this->carry) {
+		if (ferror(this->f)) {
+			fprintf(stderr, "%s: read error\n", this->file);
+			this->failed = true;
+			return;
+		}
+		this->eof = true;
+	} else {
+		while (end > 0 && buf[end-1] != '\n')
+			end--;
+		if (end == 0) {
+			fprintf(stderr, "%s:%lld: line too long\n", this->file, this->line+1);
+			this->failed = true;
+			return;
+		}
+	}
+
+	// Split at line boundaries and parse the parts in parallel,
+	// with no more parts than bytes.
+	int nparts = min(this->nthread, max(end, 1));
+	vector<int> at(nparts+1);
+	at[0] = 0;
+	for (int k = 1; k < nparts; k++) {
+		int p = max(at[k-1], max(1, (int)((long long)end * k / nparts)));
+		while (p < end && buf[p-1] != '\n')
+			p++;
+		at[k] = p;
+	}
+	at[nparts] = end;
+	EdgeListPart *part = &this->part[0];
+	ParallelFor(nparts, nparts, [=](int, int k) {
+		parseEdges(buf + at[k], buf + at[k+1], &part[k]);
+	});
+
+	// Append the parts, in order, to the current function.
+	for (int k = 0; k < nparts; k++) {
+		EdgeListPart *p = &part[k];
+		if (p->bad >= 0) {
+			fprintf(stderr, "%s:%lld: malformed edge\n", this->file, this->line + p->bad + 1);
+			this->failed = true;
+			return;
+		}
+		int h = 0;
+		for (int i = 0; i <= p->src.size(); i++) {
+			for (; h < p->head.size() && p->headAt[h] == i; h++) {
+				this->endFunction();
+				this->cur.started = true;
+				this->cur.name = p->head[h];
+			}
+			if (i == p->src.size())
+				break;
+			this->cur.started = true;
+			this->cur.src.push_back(p->src[i]);
+			this->cur.dst.push_back(p->dst[i]);
+			this->cur.nblock = max(this->cur.nblock, max(p->src[i], p->dst[i]) + 1);
+		}
+		this->line += p->nline;
+	}
+
+	this->carry = len - end;
+	memmove(buf, buf + end, this->carry);
+	if (this->eof)
+		this->endFunction();
+}
+
+// Next builds g from the next function in the file and sets name
+// to its name. It returns false at the end of the file or on error;
+// failed distinguishes the two.
+
+bool EdgeListReader::Next(FrozenCFG *g, string *name) {
+	while (this->done.empty() && !this->eof && !this->failed)
+		this->fill();
+	if (this->failed || this->done.empty())
+		return false;
+	Function &fn = this->done.front();
+	g->Build(fn.nblock, fn.src.data(), fn.dst.data(), fn.src.size(), this->nthread, false);
+	*name = fn.name;
+	this->done.pop_front();
+	return true;
+}
+
+// Statistics about one run of FindLoops.
+// Counting and timing cost a few percent; compile with -DLOOPSTATS=0
+// to remove them entirely, leaving every field zero.
+
+#ifndef LOOPSTATS
+#define LOOPSTATS 1
+#endif
+
+#if LOOPSTATS
+#define STAT(...) __VA_ARGS__
+#else
+#define STAT(...)
+#endif
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ticks returns a cheap, monotonic cycle count: the time stamp
+// counter where there is one, nanoseconds otherwise.
+
+static inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+class UnionFind;
+
+struct LoopStats {
+	enum Phase {
+		Init,		// Step A: reset per-block state
+		DFS,		// Step A: depth first numbering
+		Classify,	// Step B: back edges
+		StepC,		// Step C: walk headers in reverse preorder
+		StepD,		// Step D: seed each pool from back edges
+		StepE,		// Step E: grow pools, find irreducible loops
+		Collapse,	// build loops and union their bodies
+		NPhase,
+	};
+	static const char *phaseName[NPhase];
+
+	// Cycles are counted around each phase. The steps C to E
+	// interleave too finely to read the clock for each, so wall
+	// time is measured for the whole run and divided among the
+	// phases in proportion to their cycles.
+	uint64_t cycles[NPhase];
+	double seconds[NPhase];
+
+	// Hardware counters, if enabled and available (perfcount.h).
+	// Reading them costs a system call, so they are read only at
+	// the boundaries of the first phases, and the StepC counts
+	// cover steps C, D and E and collapsing.
+	uint64_t counter[NPhase][PerfCounters::NCounter];
+	int64_t counted;	// runs with counters
+
+	int64_t runs;		// calls to FindLoops
+	int64_t finds;		// calls to UnionFind::Find
+	int64_t findSteps;	// parent links followed by Find
+	int64_t maxFindSteps;	// longest single Find
+	int64_t pools;		// headers with a nonempty pool
+	int64_t poolBlocks;	// blocks added to pools
+	int64_t maxPool;	// largest pool
+	int64_t irreducible;	// irreducible loop headers
+	int64_t self;		// self loops
+	int64_t natural;	// runs that found natural loops from dominators
+	int64_t fallbacks;	// runs that fell back to Havlak's algorithm
+
+	LoopStats() { this->Reset(); }
+	void Reset();
+	PerfCounters *Start(bool, uint64_t*);
+	void Finish(double, const UnionFind&);
+	void Add(const LoopStats&);
+	void Count(Phase, PerfCounters*, uint64_t*);
+	void Print(FILE*);
 };
 
-const int Unvisited = -1;
+const char *LoopStats::phaseName[LoopStats::NPhase] = {
+	"init", "dfs", "classify", "stepc", "stepd", "stepe", "collapse",
+};
 
-void LoopBlock::Init(Block *b) {
-	this->block = b;
-	this->loop = NULL;
-	this->first = Unvisited;
-	this->last = Unvisited;
-	this->header = NULL;
-	this->type = LoopBlock::NonHeader;
-	this->backPred.clear();
-	this->nonBackPred.clear();
-	this->unionf = this;
+void LoopStats::Reset() {
+	memset(this, 0, sizeof *this);
 }
 
-LoopBlock *LoopBlock::Find() {
-	if (this->unionf != this) {
-		this->unionf = this->unionf->Find();
+void LoopStats::Add(const LoopStats &s) {
+	for (int i = 0; i < NPhase; i++) {
+		this->cycles[i] += s.cycles[i];
+		this->seconds[i] += s.seconds[i];
+		for (int j = 0; j < PerfCounters::NCounter; j++)
+			this->counter[i][j] += s.counter[i][j];
 	}
-	return this->unionf;
+	this->counted += s.counted;
+	this->runs += s.runs;
+	this->finds += s.finds;
+	this->findSteps += s.findSteps;
+	this->maxFindSteps = max(this->maxFindSteps, s.maxFindSteps);
+	this->pools += s.pools;
+	this->poolBlocks += s.poolBlocks;
+	this->maxPool = max(this->maxPool, s.maxPool);
+	this->irreducible += s.irreducible;
+	this->self += s.self;
+	this->natural += s.natural;
+	this->fallbacks += s.fallbacks;
 }
 
-// Depth first search to number blocks.
+// Start resets the statistics for one run. If counting, it reads
+// the counters into last and returns them, for Count; otherwise
+// it returns NULL.
 
-void LoopFinder::Search(Block *b) {
-	LoopBlock *lb = &this->loopBlock[b->name];
-	this->depthFirst.push_back(lb);
-	lb->first = this->depthFirst.size();
-	for (int i = 0; i < b->out.size(); i++) {
-		Block *out = b->out[i];
-		if (this->loopBlock[out->name].first == Unvisited)
-			this->Search(out);
+PerfCounters *LoopStats::Start(bool counting, uint64_t *last) {
+	this->Reset();
+	this->runs = 1;
+	PerfCounters *pc = counting ? ThreadCounters() : NULL;
+	if (pc != NULL) {
+		pc->Read(last);
+		this->counted = 1;
 	}
-	lb->last = this->depthFirst.size();
+	return pc;
 }
 
-bool LoopBlock::IsAncestor(LoopBlock *p) {
-	return this->first <= p->first && p->first <= this->last;
+// Count charges the counts since last to phase p and updates last.
+// It does nothing if pc is NULL.
+
+void LoopStats::Count(Phase p, PerfCounters *pc, uint64_t *last) {
+	if (pc == NULL)
+		return;
+	uint64_t v[PerfCounters::NCounter];
+	pc->Read(v);
+	for (int i = 0; i < PerfCounters::NCounter; i++) {
+		this->counter[p][i] += v[i] - last[i];
+		last[i] = v[i];
+	}
 }
 
-void LoopFinder::FindLoops(CFG *g, LoopGraph *lsg) {
-	int size = g->block.size();
-	if (size == 0)
+void LoopStats::Print(FILE *f) {
+	if (this->runs == 0) {
+		fprintf(f, "no statistics (built with LOOPSTATS=0)\n");
+		return;
+	}
+	double total = 0;
+	for (int i = 0; i < NPhase; i++)
+		total += this->seconds[i];
+	for (int i = 0; i < NPhase; i++)
+		fprintf(f, "%-9s %9.3fms %14llu cycles %5.1f%%\n",
+			phaseName[i], this->seconds[i] * 1e3,
+			(unsigned long long)this->cycles[i],
+			total > 0 ? 100 * this->seconds[i] / total : 0.0);
+	fprintf(f, "# of finds: %lld, %lld steps (%.2f per find, max %lld)\n",
+		(long long)this->finds, (long long)this->findSteps,
+		this->finds ? (double)this->findSteps / this->finds : 0.0,
+		(long long)this->maxFindSteps);
+	fprintf(f, "# of pools: %lld, %lld blocks (max %lld)\n",
+		(long long)this->pools, (long long)this->poolBlocks,
+		(long long)this->maxPool);
+	fprintf(f, "# of irreducible headers: %lld, self loops: %lld, runs: %lld\n",
+		(long long)this->irreducible, (long long)this->self,
+		(long long)this->runs);
+	if (this->natural > 0 || this->fallbacks > 0)
+		fprintf(f, "# of natural loop runs: %lld, irreducible fallbacks: %lld\n",
+			(long long)this->natural, (long long)this->fallbacks);
+	if (this->counted == 0)
 		return;
+	fprintf(f, "%-9s", "counters");
+	for (int j = 0; j < PerfCounters::NCounter; j++)
+		fprintf(f, " %14s", PerfCounters::name[j]);
+	fprintf(f, "\n");
+	for (int i = 0; i <= StepC; i++) {
+		fprintf(f, "%-9s", i == StepC ? "stepc-e" : phaseName[i]);
+		for (int j = 0; j < PerfCounters::NCounter; j++)
+			fprintf(f, " %14llu", (unsigned long long)this->counter[i][j]);
+		fprintf(f, "\n");
+	}
+}
 
-	// Step A: Initialize nodes, depth first numbering, mark dead nodes.
-	this->loopBlock.resize(size);
-	this->depthFirst.reserve(size);
-	this->depthFirst.clear();
-	for (int i = 0; i < size; i++)
-		this->loopBlock[i].Init(g->block[i]);
-	this->Search(g->block[0]);
-	for (int i = 0; i < size; i++ ){
-		LoopBlock *lb = &this->loopBlock[i];  // TODO
-		if (lb->first == Unvisited)
-			lb->type = LoopBlock::Dead;
+// Basic representation of loop graph.
+// A LoopGraph keeps its loops in one flat array: loop[0] is the
+// artificial root, and loop[1], loop[2], ... are the loops in the
+// order FindLoops creates them, which is reverse depth first order
+// of their headers, so the numbering depends only on the CFG, not on
+// earlier or concurrent analyses. Inner loops are created before the
+// loops around them, so every loop's number is less than its parent's.
+//
+// Loops refer to each other and to blocks by number. The blocks of
+// all loops share one array, each loop owning the slice from blockOff
+// to blockEnd, which holds its header and the blocks that are not in
+// nested loops. A forest thus costs a few allocations however many
+// loops it has, and none when the LoopGraph is reused.
+//
+// For queries, blockLoop maps each block to the innermost loop
+// containing it, and the loops are numbered in preorder and
+// postorder of the loop tree, so that loop a is nested in loop b
+// exactly when b.pre <= a.pre and a.post <= b.post.
+//
+// An incremental update (see IncrementalLoopFinder) replaces loops
+// by killing them, leaving dead entries that every walk over the
+// array skips, and appending their replacements; Compact squeezes
+// the dead entries out, renumbering the live loops in order.
+
+struct Loop {
+	int head;	// header block, -1 for the root
+	int parent;	// enclosing loop, 0 (the root) for outermost loops
+	int firstChild;	// first loop directly inside, 0 if none
+	int nextSibling;	// next loop with the same parent, 0 if none
+	int blockOff;
+	int blockEnd;
+	int depth;	// 0 for the root, 1 for outermost loops
+	int nesting;	// 0 for innermost loops
+	int pre;	// preorder number in the loop tree, 0 for the root
+	int post;	// postorder number, NumLoops() for the root
+	bool isReducible;
+	bool isDead;
+};
+
+class LoopGraph {
+public:
+	vector<Loop> loop;
+	vector<int> block;
+	vector<int> blockLoop;	// innermost loop of each block, 0 if none
+	int ndead;	// dead loops
+	LoopStats stats;	// from the FindLoops that filled in the graph
+
+	LoopGraph() { this->Clear(0); }
+
+	void Clear(int nblock);
+	void Reserve(int nloop, int nblock);
+	int NumLoops() { return this->loop.size() - 1 - this->ndead; }
+	int NewLoop(int head, bool reducible);
+	void AddBlock(int b);
+	void Kill(int l);
+	void Compact();
+	void CalculateNesting();
+
+	// InnermostLoop returns the innermost loop containing block b,
+	// or 0 if b is in no loop.
+	int InnermostLoop(int b) {
+		return this->blockLoop[b];
 	}
 
-	// Step B: Classify back edges as coming from descendents or not.
-	for (int i = 0; i < this->depthFirst.size(); i++) {
-		LoopBlock *lb = this->depthFirst[i];
-		for (int j = 0; j < lb->block->in.size(); j++) {
-			Block *b = lb->block->in[j];
-			LoopBlock *lbb = &this->loopBlock[b->name];  // TODO
-			if (lb->IsAncestor(lbb))
-				lb->backPred.push_back(lbb);
-			else
-				lb->nonBackPred.push_back(lbb);
-		}
+	// Nested reports whether loop a is loop b or nested inside it.
+	bool Nested(int a, int b) {
+		Loop *la = &this->loop[a];
+		Loop *lb = &this->loop[b];
+		return lb->pre <= la->pre && la->post <= lb->post;
 	}
 
-	// Start node is root of all other loops.
-	this->loopBlock[0].header = &this->loopBlock[0];
+	// InLoop reports whether block b is in loop l,
+	// directly or in a loop nested inside it.
+	bool InLoop(int b, int l) {
+		return this->Nested(this->blockLoop[b], l);
+	}
 
-	// Step C:
-	//
-	// The outer loop, unchanged from Tarjan. It does nothing except
-	// for those nodes which are the destinations of backedges.
-	// For a header node w, we chase backward from the sources of the
-	// backedges adding nodes to the set P, representing the body of
-	// the loop headed by w.
-	//
-	// By running through the nodes in reverse of the DFST preorder,
-	// we ensure that inner loop headers will be processed before the
-	// headers for surrounding loops.
-	for (int i = this->depthFirst.size() - 1; i >= 0; i--) {
-		LoopBlock *w = this->depthFirst[i];
+	uint64_t Hash();
+	void Canon(vector<CanonLoop>*);
+	bool WriteCanon(const char *file);
+};
 
-		this->pool.clear();
+// Clear removes every loop but the root, keeping the storage,
+// and makes room for nblock blocks, all in no loop. Only blocks
+// listed in the old loops can be in one, so only theirs are reset:
+// clearing costs the size of the old forest, not of the CFG.
 
-		// Step D.
-		for (int i = 0; i < w->backPred.size(); i++) {
-			LoopBlock* pred = w->backPred[i];
-			if (w == pred) {
-				w->type = LoopBlock::Self;
-				continue;
-			}
-			this->pool.push_back(pred->Find());
-		}
-
-		// Process node pool in order as work list.
-		for (int i = 0; i < this->pool.size(); i++) {
-			LoopBlock *x = this->pool[i];
-
-			// Step E:
-			//
-			// Step E represents the main difference from Tarjan's method.
-			// Chasing upwards from the sources of a node w's backedges. If
-			// there is a node y' that is not a descendant of w, w is marked
-			// the header of an irreducible loop, there is another entry
-			// into this loop that avoids w->
-			for (int j = 0; j < x->nonBackPred.size(); j++) {
-				LoopBlock *y = x->nonBackPred[j];
-				LoopBlock *ydash = y->Find();
-				if (!w->IsAncestor(ydash)) {
-					w->type = LoopBlock::Irreducible;
-					if (find(w->nonBackPred.begin(), w->nonBackPred.end(), y) == w->nonBackPred.end())
-						w->nonBackPred.push_back(y);
-				} else if (ydash != w) {
-					if (find(this->pool.begin(), this->pool.end(), ydash) == this->pool.end())
-						this->pool.push_back(ydash);
-				}
-			}
-		}
+void LoopGraph::Clear(int nblock) {
+	Loop root = {-1, -1, 0, 0, 0, 0, 0, 0, 0, 0, true, false};
+	for (int i = 0; i < this->block.size(); i++)
+		if (this->block[i] < this->blockLoop.size())
+			this->blockLoop[this->block[i]] = 0;
+	this->loop.clear();
+	this->loop.push_back(root);
+	this->block.clear();
+	this->ndead = 0;
+	this->blockLoop.resize(nblock, 0);
+}
 
-		// Collapse/Unionize nodes in a SCC to a single node
-		// For every SCC found, create a loop descriptor and link it in.
-		if (this->pool.size() > 0 || w->type == LoopBlock::Self) {
-			Loop *l = lsg->NewLoop(1 + pool.size());
-			l->head = w->block;
-			l->block.push_back(w->block);
-			l->isReducible = w->type != LoopBlock::Irreducible;
-			w->loop = l;
-
-			// At this point, one can set attributes to the loop, such as:
-			//
-			// the bottom node:
-			//    iter  = backPreds[w].begin();
-			//    loop bottom is: nodes[iter].node);
-			//
-			// the number of backedges:
-			//    backPreds[w].size()
-			for (int i = 0; i < pool.size(); i++) {
-				LoopBlock *node = pool[i];
-				// Add nodes to loop descriptor.
-				node->header = w;
-				node->unionf = w;
-
-				// Nested loops are not added, but linked together.
-				if (node->loop != NULL) {
-					node->loop->parent = l;
-				} else {
-					l->block.push_back(node->block);
-				}
-			}
-		}
-	}
+// Reserve makes room for nloop loops holding nblock blocks in all.
+
+void LoopGraph::Reserve(int nloop, int nblock) {
+	this->loop.reserve(1 + nloop);
+	this->block.reserve(nblock);
 }
 
-// Main program.
+// NewLoop adds an outermost loop headed by head and returns its
+// number. AddBlock then adds blocks to it until the next NewLoop.
 
-int main() {
-	LoopFinder f;
-	
-	CFG *g = BuildGraph();
-	LoopGraph lsg;
-	f.FindLoops(g, &lsg);
-	
-	for (int i = 0; i < 50; i++) {
-		LoopGraph lsg;
-		f.FindLoops(g, &lsg);
+int LoopGraph::NewLoop(int head, bool reducible) {
+	int n = this->block.size();
+	Loop l = {head, 0, 0, 0, n, n, 0, 0, 0, 0, reducible, false};
+	this->loop.push_back(l);
+	this->AddBlock(head);
+	return this->loop.size() - 1;
+}
+
+void LoopGraph::AddBlock(int b) {
+	this->blockLoop[b] = this->loop.size() - 1;
+	this->block.push_back(b);
+	this->loop.back().blockEnd = this->block.size();
+}
+
+// Kill marks loop l dead. Its blocks must be added to other loops,
+// or to none, before the graph is used again.
+
+void LoopGraph::Kill(int l) {
+	this->loop[l].isDead = true;
+	this->ndead++;
+}
+
+// Compact removes the dead loops, renumbering the others in order,
+// so that parents still come after their children, and copying
+// their blocks into a fresh array without the dead loops' slices.
+// Only the blocks of live loops are in any loop, so only theirs
+// need their innermost loops renumbered.
+
+void LoopGraph::Compact() {
+	if (this->ndead == 0)
+		return;
+	int n = this->loop.size();
+	vector<int> number(n);
+	vector<int> block;
+	block.reserve(this->block.size());
+	int k = 0;
+	for (int i = 0; i < n; i++)
+		if (!this->loop[i].isDead)
+			number[i] = k++;
+	k = 0;
+	for (int i = 0; i < n; i++) {
+		Loop l = this->loop[i];
+		if (l.isDead)
+			continue;
+		int off = block.size();
+		for (int j = l.blockOff; j < l.blockEnd; j++) {
+			block.push_back(this->block[j]);
+			this->blockLoop[this->block[j]] = k;
+		}
+		l.blockOff = off;
+		l.blockEnd = block.size();
+		if (l.parent > 0)
+			l.parent = number[l.parent];
+		this->loop[k++] = l;
+	}
+	this->loop.resize(k);
+	this->block.swap(block);
+	this->ndead = 0;
+	this->CalculateNesting();
+}
+
+// Hash returns a hash of each loop's number, header, parent
+// and blocks, for comparing the results of different runs.
+
+uint64_t LoopGraph::Hash() {
+	uint64_t h = 14695981039346656037ULL;
+	for (int i = 1; i < this->loop.size(); i++) {
+		Loop *l = &this->loop[i];
+		if (l->isDead)
+			continue;
+		int v[3] = {i, l->head, l->parent};
+		for (int j = 0; j < 3; j++)
+			h = (h ^ v[j]) * 1099511628211ULL;
+		for (int j = l->blockOff; j < l->blockEnd; j++)
+			h = (h ^ this->block[j]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+// Canon sets canon to the loops in the canonical form of canon.h,
+// sorted by header, each loop's blocks sorted too.
+
+void LoopGraph::Canon(vector<CanonLoop> *canon) {
+	canon->resize(this->NumLoops());
+	int k = 0;
+	for (int i = 1; i < this->loop.size(); i++) {
+		Loop *l = &this->loop[i];
+		if (l->isDead)
+			continue;
+		CanonLoop *c = &(*canon)[k++];
+		c->head = l->head;
+		c->parent = l->parent > 0 ? this->loop[l->parent].head : -1;
+		c->reducible = l->isReducible;
+		c->block.assign(this->block.begin() + l->blockOff, this->block.begin() + l->blockEnd);
+		sort(c->block.begin(), c->block.end());
+	}
+	sort(canon->begin(), canon->end());
+}
+
+// WriteCanon writes the loops in the canonical form of canon.h,
+// for comparison with the other loop finders.
+
+bool LoopGraph::WriteCanon(const char *file) {
+	vector<CanonLoop> canon;
+	this->Canon(&canon);
+	return ::WriteCanon(file, &canon);
+}
+
+// CalculateNesting links each loop into its parent's list of
+// children, in increasing order, and sets depth, nesting and the
+// preorder and postorder numbers. Because parents come after their
+// children, a few passes up and down the array suffice, without
+// recursion or a stack. Dead loops are left out of the tree.
+
+void LoopGraph::CalculateNesting() {
+	Loop *loop = &this->loop[0];
+	int n = this->loop.size();
+
+	// Going up, children before parents: nesting, and in post
+	// for now, the number of loops in each subtree.
+	for (int i = 0; i < n; i++) {
+		loop[i].firstChild = 0;
+		loop[i].nesting = 0;
+		loop[i].post = 1;
+	}
+	for (int i = 1; i < n; i++) {
+		if (loop[i].isDead)
+			continue;
+		Loop *p = &loop[loop[i].parent];
+		if (p->nesting < loop[i].nesting + 1)
+			p->nesting = loop[i].nesting + 1;
+		p->post += loop[i].post;
+	}
+
+	// Going down, parents before children: depth and child lists.
+	loop[0].depth = 0;
+	for (int i = n-1; i > 0; i--) {
+		if (loop[i].isDead)
+			continue;
+		Loop *p = &loop[loop[i].parent];
+		loop[i].depth = p->depth + 1;
+		loop[i].nextSibling = p->firstChild;
+		p->firstChild = i;
+	}
+
+	// Going down again, with each loop's children now complete:
+	// a child's subtree starts right after the subtrees of the
+	// siblings before it. A loop's postorder number is its preorder
+	// number plus its descendants minus its ancestors.
+	loop[0].pre = 0;
+	for (int k = 0; k < n; k++) {
+		Loop *l = &loop[k == 0 ? 0 : n-k];	// the root, then n-1 down to 1
+		if (l->isDead)
+			continue;
+		int pre = l->pre + 1;
+		for (int c = l->firstChild; c != 0; c = loop[c].nextSibling) {
+			loop[c].pre = pre;
+			pre += loop[c].post;
+		}
+		l->post = l->pre + l->post - 1 - l->depth;
+	}
+}
+
+// TODO: Dump, String
+
+// Disjoint sets of blocks, for collapsing loop bodies into headers.
+// Parent links are block numbers in one dense array. Union links
+// by rank and Find halves paths as it goes, so neither recurses
+// nor allocates. Because the tree root need not be the header,
+// each root carries a label naming the header of its set, which
+// is what Find returns; root maps each header back to its root.
+
+class UnionFind {
+public:
+	struct Node {
+		int32_t parent;
+		int32_t label;
+	};
+	vector<Node> node;
+	vector<int32_t> root;
+	vector<uint8_t> rank;
+
+	// Statistics: calls to Find, links followed by them,
+	// and the most followed by any one call.
+	int64_t finds;
+	int64_t steps;
+	int64_t maxSteps;
+
+	UnionFind() : finds(0), steps(0), maxSteps(0) {}
+	void Init(int);
+	void Reset(int);
+	int Find(int);
+	void Union(int, int);
+};
+
+// Init makes room for n elements and clears the statistics.
+// It leaves the elements as they were: each must be Reset
+// before its first Find or Union.
+
+void UnionFind::Init(int n) {
+	this->node.resize(n);
+	this->root.resize(n);
+	this->rank.resize(n);
+	this->finds = 0;
+	this->steps = 0;
+	this->maxSteps = 0;
+}
+
+// Reset makes x a set of its own again. The other members
+// of its set must be reset too before the next Find.
+
+void UnionFind::Reset(int x) {
+	this->node[x].parent = x;
+	this->node[x].label = x;
+	this->root[x] = x;
+	this->rank[x] = 0;
+}
+
+int UnionFind::Find(int x) {
+	Node *node = &this->node[0];
+	STAT(int64_t steps = 0;)
+	while (node[x].parent != x) {
+		STAT(steps++;)
+		node[x].parent = node[node[x].parent].parent;
+		x = node[x].parent;
+	}
+	STAT(
+		this->finds++;
+		this->steps += steps;
+		if (steps > this->maxSteps)
+			this->maxSteps = steps;
+	)
+	return node[x].label;
+}
+
+// Union merges the set headed by x into the set headed by h.
+// Both must be headers, as returned by Find.
+
+void UnionFind::Union(int x, int h) {
+	int rx = this->root[x];
+	int rh = this->root[h];
+	if (rx == rh)
+		return;
+	if (this->rank[rx] > this->rank[rh]) {
+		int t = rx;
+		rx = rh;
+		rh = t;
+	} else if (this->rank[rx] == this->rank[rh]) {
+		this->rank[rh]++;
+	}
+	this->node[rx].parent = rh;
+	this->node[rh].label = h;
+	this->root[h] = rh;
+}
+
+// Finish ends a run that started at time t0: it divides the wall
+// time among the phases in proportion to their cycles and records
+// the statistics of uf, which the run used alone.
+
+void LoopStats::Finish(double t0, const UnionFind &uf) {
+	uint64_t total = 0;
+	for (int i = 0; i < NPhase; i++)
+		total += this->cycles[i];
+	double secs = now() - t0;
+	for (int i = 0; i < NPhase; i++)
+		this->seconds[i] = total ? secs * this->cycles[i] / total : 0;
+	this->finds = uf.finds;
+	this->findSteps = uf.steps;
+	this->maxFindSteps = uf.maxSteps;
+}
+
+// Loop finding state, generated or reused on each iteration.
+
+class LoopBlock {
+public:
+	enum Type {
+		NonHeader,
+		Reducible,
+		Self,
+		Irreducible,
+		Dead,
+	};
+
+	int name;
+	int loop;	// number of the loop this block heads, 0 if none
+	int first;
+	int last;
+	LoopBlock *header; // TODO: head
+	Type type;
+	vector<LoopBlock*> backPred;
+	vector<LoopBlock*> nonBackPred;
+
+	// Membership stamps for Step E. A block is in the pool of
+	// header w, or in w's nonBackPred, when its stamp is w->first.
+	// Headers are visited once each, so stamps never need clearing.
+	int inPool;
+	int inNonBackPred;
+
+	// The LoopFinder run that last reset this block. The fields
+	// above are left over from an earlier run unless it is current.
+	int epoch;
+
+	void Init(int);
+	bool IsAncestor(LoopBlock*);
+	
+};
+
+class LoopFinder;
+
+// Dominator tree, by the semi-NCA algorithm of Georgiadis, Tarjan
+// and Werneck, a simpler relative of Lengauer and Tarjan's that is
+// as fast in practice. It reuses the depth first numbering that
+// LoopFinder::Number computes, so after FindLoops the dominators
+// cost only the two passes below. All the working arrays are
+// indexed by depth first number and kept between builds.
+//
+// The tree is numbered in preorder and postorder like the loop
+// forest, so that Dominates takes two comparisons. A block the
+// entry cannot reach dominates only itself.
+
+class DomTree {
+public:
+	vector<int> idom;	// immediate dominator of each block, -1 for the entry and dead blocks
+	vector<int> pre;	// preorder number of each block in the tree
+	vector<int> post;	// postorder number
+
+	void Build(FrozenCFG*, LoopFinder*);
+
+	// Dominates reports whether block a dominates block b.
+	bool Dominates(int a, int b) {
+		return this->pre[a] <= this->pre[b] && this->post[b] <= this->post[a];
+	}
+
+private:
+	vector<int> semi;
+	vector<int> label;
+	vector<int> ancestor;
+	vector<int> dom;	// idom by depth first number
+	vector<int> size;
+	vector<int> num;	// depth first number of each block, -1 if dead
+	vector<int> name;	// block of each depth first number
+	vector<int> path;
+
+	int eval(int);
+};
+
+// A pending block in the depth first search: the block
+// and the offset of its next unexplored out edge.
+struct SearchFrame {
+	SearchFrame(int b, int n) : block(b), next(n) {}
+	int block;
+	int next;
+};
+
+class LoopFinder {
+public:
+	vector<LoopBlock> loopBlock;
+	vector<LoopBlock*> depthFirst;
+	vector<int> dfsParent;	// depth first tree parent of depthFirst[i], by index
+	vector<LoopBlock*> pool;
+	vector<SearchFrame> stack;
+	UnionFind uf;
+	FrozenCFG frozen;
+	bool recursive;
+	bool natural;	// find natural loops from dominators when reducible
+	bool counters;	// read hardware counters into LoopStats
+	int epoch;	// the current run, for LoopBlock::epoch
+	DomTree dom;
+
+	LoopFinder() : recursive(false), natural(false), counters(false), epoch(0) {}
+
+	// Block returns block b's state, resetting it first if
+	// the current run has not touched it yet.
+	LoopBlock *Block(int b) {
+		LoopBlock *lb = &this->loopBlock[b];
+		if (lb->epoch != this->epoch) {
+			lb->Init(b);
+			lb->epoch = this->epoch;
+			this->uf.Reset(b);
+		}
+		return lb;
+	}
+
+	LoopBlock *Find(LoopBlock*);
+	void Init(int);
+	void Number(FrozenCFG*);
+	void NumberFrom(FrozenCFG*, int);
+	void Search(FrozenCFG*, int);
+	void SearchRecursive(FrozenCFG*, int, int);
+	void FindLoops(FrozenCFG*, LoopGraph*);
+	void FindLoops(CFG*, LoopGraph*);
+	void FindRegionLoops(FrozenCFG*, int, LoopGraph*);
+	bool FindNaturalLoops(FrozenCFG*, LoopGraph*);
+	void findLoops(FrozenCFG*, int, bool, LoopGraph*);
+	void findLoop(LoopBlock*, LoopGraph*);
+	void collapse(LoopBlock*, LoopGraph*);
+};
+
+const int Unvisited = -1;
+
+void LoopBlock::Init(int name) {
+	this->name = name;
+	this->loop = 0;
+	this->first = Unvisited;
+	this->last = Unvisited;
+	this->header = NULL;
+	this->type = LoopBlock::NonHeader;
+	this->backPred.clear();
+	this->nonBackPred.clear();
+	this->inPool = Unvisited;
+	this->inNonBackPred = Unvisited;
+}
+
+LoopBlock *LoopFinder::Find(LoopBlock *b) {
+	LoopBlock *base = &this->loopBlock[0];
+	return base + this->uf.Find(b - base);
+}
+
+// Depth first search to number blocks.
+// The search keeps its own stack, reused across calls, so that
+// long chains of blocks cannot overflow the thread stack.
+
+void LoopFinder::Search(FrozenCFG *g, int b) {
+	LoopBlock *lb = this->Block(b);
+	this->depthFirst.push_back(lb);
+	this->dfsParent.push_back(-1);
+	lb->first = this->depthFirst.size();
+	this->stack.clear();
+	this->stack.push_back(SearchFrame(b, g->outOff[b]));
+	while (!this->stack.empty()) {
+		SearchFrame *f = &this->stack.back();
+		if (f->next < g->outOff[f->block+1]) {
+			int out = g->out[f->next++];
+			lb = this->Block(out);
+			if (lb->first == Unvisited) {
+				this->depthFirst.push_back(lb);
+				this->dfsParent.push_back(this->loopBlock[f->block].first - 1);
+				lb->first = this->depthFirst.size();
+				this->stack.push_back(SearchFrame(out, g->outOff[out]));
+			}
+			continue;
+		}
+		this->loopBlock[f->block].last = this->depthFirst.size();
+		this->stack.pop_back();
+	}
+}
+
+// The original recursive search, kept for comparison (-recursivedfs).
+// It assigns the same numbering as Search.
+
+void LoopFinder::SearchRecursive(FrozenCFG *g, int b, int parent) {
+	LoopBlock *lb = this->Block(b);
+	this->depthFirst.push_back(lb);
+	this->dfsParent.push_back(parent);
+	lb->first = this->depthFirst.size();
+	for (int i = g->outOff[b]; i < g->outOff[b+1]; i++) {
+		int out = g->out[i];
+		if (this->Block(out)->first == Unvisited)
+			this->SearchRecursive(g, out, lb->first - 1);
+	}
+	lb->last = this->depthFirst.size();
+}
+
+bool LoopBlock::IsAncestor(LoopBlock *p) {
+	return this->first <= p->first && p->first <= this->last;
+}
+
+// Init starts a new run on a graph of size blocks. Rather than
+// resetting every block, it starts a new epoch, and Block resets
+// each block when the run first touches it, so a run costs the
+// size of the part of the graph it explores, not of the graph.
+
+void LoopFinder::Init(int size) {
+	this->loopBlock.resize(size);
+	this->depthFirst.reserve(size);
+	this->depthFirst.clear();
+	this->dfsParent.reserve(size);
+	this->dfsParent.clear();
+	this->uf.Init(size);
+	if (this->epoch == INT_MAX) {
+		for (int i = 0; i < size; i++)
+			this->loopBlock[i].epoch = 0;
+		this->epoch = 0;
+	}
+	this->epoch++;
+}
+
+// Number numbers the blocks of g in depth first order from the
+// entry, recording the depth first tree, and marks the blocks
+// it cannot reach dead, so that every block's state is current.
+// FindLoops starts with Init and Number; the dominator tree
+// reuses the numbering they leave behind.
+
+void LoopFinder::Number(FrozenCFG *g) {
+	this->NumberFrom(g, 0);
+	for (int i = 0; i < g->nblock; i++) {
+		LoopBlock *lb = this->Block(i);
+		if (lb->first == Unvisited)
+			lb->type = LoopBlock::Dead;
+	}
+}
+
+// NumberFrom numbers the blocks of g reachable from entry,
+// touching no others. Blocks it does not reach keep whatever
+// state earlier runs left them.
+
+void LoopFinder::NumberFrom(FrozenCFG *g, int entry) {
+	if (this->recursive)
+		this->SearchRecursive(g, entry, -1);
+	else
+		this->Search(g, entry);
+}
+
+// FindLoops on a CFG freezes it first.
+// Callers analysing the same graph repeatedly should freeze it
+// once themselves and use the FrozenCFG form directly.
+
+void LoopFinder::FindLoops(CFG *g, LoopGraph *lsg) {
+	this->frozen.Freeze(g);
+	this->FindLoops(&this->frozen, lsg);
+}
+
+void LoopFinder::FindLoops(FrozenCFG *g, LoopGraph *lsg) {
+	this->findLoops(g, 0, true, lsg);
+}
+
+// FindRegionLoops finds the loops of the region of g reachable
+// from entry, as if entry were the entry of a graph of its own,
+// for analysing one function of a graph holding many. Its cost
+// depends only on the size of the region: the blocks outside are
+// never touched, and their state, and blockLoop entries in lsg,
+// are left as they were. It always uses Havlak's algorithm.
+
+void LoopFinder::FindRegionLoops(FrozenCFG *g, int entry, LoopGraph *lsg) {
+	this->findLoops(g, entry, false, lsg);
+}
+
+// findLoops analyses the region of g reachable from entry,
+// or all of g if whole is set.
+
+void LoopFinder::findLoops(FrozenCFG *g, int entry, bool whole, LoopGraph *lsg) {
+	int size = g->nblock;
+	lsg->Clear(size);
+	if (size == 0)
+		return;
+	if (whole && this->natural && this->FindNaturalLoops(g, lsg))
+		return;
+
+	STAT(
+		LoopStats *st = &lsg->stats;
+		uint64_t pv[PerfCounters::NCounter];
+		PerfCounters *pc = st->Start(this->counters, pv);
+		st->fallbacks = whole && this->natural;
+		double t0 = now();
+		uint64_t c0 = ticks(), c;
+	)
+
+	// Step A: Initialize nodes, depth first numbering, mark dead nodes.
+	this->Init(size);
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::Init] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::Init, pc, pv);
+	)
+	if (whole)
+		this->Number(g);
+	else
+		this->NumberFrom(g, entry);
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::DFS] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::DFS, pc, pv);
+	)
+
+	// Step B: Classify back edges as coming from descendents or not.
+	// Only blocks with back edges can head loops, and each block
+	// is listed in at most one loop, which bounds the loop graph.
+	int nhead = 0;
+	for (int i = 0; i < this->depthFirst.size(); i++) {
+		LoopBlock *lb = this->depthFirst[i];
+		for (int j = g->inOff[lb->name]; j < g->inOff[lb->name+1]; j++) {
+			// A block of an earlier epoch is outside the region;
+			// reading it rather than resetting it through Block
+			// leaves it untouched.
+			LoopBlock *lbb = &this->loopBlock[g->in[j]];
+			if (lbb->epoch != this->epoch || lbb->first == Unvisited)
+				continue;	// dead block, or outside the region
+			if (lb->IsAncestor(lbb))
+				lb->backPred.push_back(lbb);
+			else
+				lb->nonBackPred.push_back(lbb);
+		}
+		nhead += lb->backPred.size() > 0;
+	}
+	lsg->Reserve(nhead, this->depthFirst.size());
+
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::Classify] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::Classify, pc, pv);
+	)
+
+	// Start node is root of all other loops.
+	this->loopBlock[entry].header = &this->loopBlock[entry];
+
+	// Step C:
+	//
+	// The outer loop, unchanged from Tarjan. It does nothing except
+	// for those nodes which are the destinations of backedges.
+	// For a header node w, we chase backward from the sources of the
+	// backedges adding nodes to the set P, representing the body of
+	// the loop headed by w.
+	//
+	// By running through the nodes in reverse of the DFST preorder,
+	// we ensure that inner loop headers will be processed before the
+	// headers for surrounding loops.
+	STAT(uint64_t stepc = c0;)
+	for (int i = this->depthFirst.size() - 1; i >= 0; i--) {
+		LoopBlock *w = this->depthFirst[i];
+
+		// Only the destinations of back edges can head loops.
+		if (w->backPred.size() > 0)
+			this->findLoop(w, lsg);
+	}
+	STAT(uint64_t c1 = ticks();)
+	lsg->CalculateNesting();
+	STAT(st->cycles[LoopStats::Collapse] += ticks() - c1;)
+
+	STAT(
+		st->Count(LoopStats::StepC, pc, pv);
+		c = ticks();
+		st->cycles[LoopStats::StepC] = c - stepc - st->cycles[LoopStats::StepD] -
+			st->cycles[LoopStats::StepE] - st->cycles[LoopStats::Collapse];
+		st->Finish(t0, this->uf);
+	)
+}
+
+// findLoop runs steps D and E for header w, once the loops
+// nested inside it have been collapsed, and makes its loop.
+
+void LoopFinder::findLoop(LoopBlock *w, LoopGraph *lsg) {
+	STAT(
+		LoopStats *st = &lsg->stats;
+		uint64_t c;
+	)
+	this->pool.clear();
+	STAT(uint64_t c1 = ticks();)
+
+	// Step D.
+	for (int i = 0; i < w->backPred.size(); i++) {
+		LoopBlock* pred = w->backPred[i];
+		if (w == pred) {
+			w->type = LoopBlock::Self;
+			continue;
+		}
+		LoopBlock *x = this->Find(pred);
+		if (x->inPool != w->first) {
+			x->inPool = w->first;
+			this->pool.push_back(x);
+		}
+	}
+	STAT(c = ticks(); st->cycles[LoopStats::StepD] += c - c1; c1 = c;)
+
+	// Process node pool in order as work list.
+	for (int i = 0; i < this->pool.size(); i++) {
+		LoopBlock *x = this->pool[i];
+
+		// Step E:
+		//
+		// Step E represents the main difference from Tarjan's method.
+		// Chasing upwards from the sources of a node w's backedges. If
+		// there is a node y' that is not a descendant of w, w is marked
+		// the header of an irreducible loop, there is another entry
+		// into this loop that avoids w->
+		for (int j = 0; j < x->nonBackPred.size(); j++) {
+			LoopBlock *y = x->nonBackPred[j];
+			LoopBlock *ydash = this->Find(y);
+			if (!w->IsAncestor(ydash)) {
+				if (w->type != LoopBlock::Irreducible) {
+					w->type = LoopBlock::Irreducible;
+					for (int k = 0; k < w->nonBackPred.size(); k++)
+						w->nonBackPred[k]->inNonBackPred = w->first;
+				}
+				if (y->inNonBackPred != w->first) {
+					y->inNonBackPred = w->first;
+					w->nonBackPred.push_back(y);
+				}
+			} else if (ydash != w && ydash->inPool != w->first) {
+				ydash->inPool = w->first;
+				this->pool.push_back(ydash);
+			}
+		}
+	}
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::StepE] += c - c1;
+		c1 = c;
+		if (pool.size() > 0) {
+			st->pools++;
+			st->poolBlocks += pool.size();
+			st->maxPool = max(st->maxPool, (int64_t)pool.size());
+		}
+		st->irreducible += w->type == LoopBlock::Irreducible;
+		st->self += w->type == LoopBlock::Self;
+	)
+
+	this->collapse(w, lsg);
+	STAT(st->cycles[LoopStats::Collapse] += ticks() - c1;)
+}
+
+// collapse makes the loop headed by w from the pool of blocks
+// found in its body, if any, and unites the body with w.
+
+void LoopFinder::collapse(LoopBlock *w, LoopGraph *lsg) {
+	// Collapse/Unionize nodes in a SCC to a single node
+	// For every SCC found, create a loop descriptor and link it in.
+	if (this->pool.size() == 0 && w->type != LoopBlock::Self)
+		return;
+	int l = lsg->NewLoop(w->name, w->type != LoopBlock::Irreducible);
+	w->loop = l;
+
+	// At this point, one can set attributes to the loop, such as:
+	//
+	// the bottom node:
+	//    iter  = backPreds[w].begin();
+	//    loop bottom is: nodes[iter].node);
+	//
+	// the number of backedges:
+	//    backPreds[w].size()
+	for (int i = 0; i < this->pool.size(); i++) {
+		LoopBlock *node = this->pool[i];
+		// Add nodes to loop descriptor.
+		node->header = w;
+		this->uf.Union(node->name, w->name);
+
+		// Nested loops are not added, but linked together.
+		if (node->loop != 0) {
+			lsg->loop[node->loop].parent = l;
+		} else {
+			lsg->AddBlock(node->name);
+		}
+	}
+}
+
+// FindNaturalLoops is the dominator-based engine. In a reducible
+// graph every depth first back edge u -> w has w dominating u, and
+// the loop headed by w is the union of the natural loops of its
+// back edges: w and the blocks that reach a back edge source without
+// passing through w, none of which can be entered from outside.
+// Headers are visited in reverse preorder and inner loops collapsed
+// into their headers as in FindLoops, so the loops come out the same,
+// but Step B's predecessor lists and Step E's irreducibility tests
+// are not needed: the body search reads predecessors straight from g.
+//
+// If some back edge's target does not dominate its source, the graph
+// is irreducible, and FindNaturalLoops returns false having built no
+// loops, for FindLoops to carry on with Havlak's algorithm.
+
+bool LoopFinder::FindNaturalLoops(FrozenCFG *g, LoopGraph *lsg) {
+	int size = g->nblock;
+	STAT(
+		LoopStats *st = &lsg->stats;
+		uint64_t pv[PerfCounters::NCounter];
+		PerfCounters *pc = st->Start(this->counters, pv);
+		st->natural = 1;
+		double t0 = now();
+		uint64_t c0 = ticks(), c;
+	)
+
+	this->Init(size);
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::Init] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::Init, pc, pv);
+	)
+	this->Number(g);
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::DFS] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::DFS, pc, pv);
+	)
+
+	// Dominators, and the back edges, which must all be
+	// dominator back edges. Their targets are marked as
+	// reducible headers for now.
+	this->dom.Build(g, this);
+	int nhead = 0;
+	for (int i = 0; i < this->depthFirst.size(); i++) {
+		LoopBlock *w = this->depthFirst[i];
+		for (int j = g->inOff[w->name]; j < g->inOff[w->name+1]; j++) {
+			int u = g->in[j];
+			if (!w->IsAncestor(&this->loopBlock[u]))
+				continue;
+			if (!this->dom.Dominates(w->name, u))
+				return false;
+			w->type = LoopBlock::Reducible;
+		}
+		nhead += w->type == LoopBlock::Reducible;
+	}
+	lsg->Reserve(nhead, this->depthFirst.size());
+	STAT(
+		c = ticks();
+		st->cycles[LoopStats::Classify] = c - c0;
+		c0 = c;
+		st->Count(LoopStats::Classify, pc, pv);
+	)
+
+	this->loopBlock[0].header = &this->loopBlock[0];
+	for (int i = this->depthFirst.size() - 1; i >= 0; i--) {
+		LoopBlock *w = this->depthFirst[i];
+		if (w->type == LoopBlock::NonHeader)
+			continue;
+		this->pool.clear();
+		STAT(uint64_t c1 = ticks();)
+
+		// Seed the pool from the back edges.
+		for (int j = g->inOff[w->name]; j < g->inOff[w->name+1]; j++) {
+			LoopBlock *pred = &this->loopBlock[g->in[j]];
+			if (!w->IsAncestor(pred))
+				continue;
+			if (pred == w) {
+				w->type = LoopBlock::Self;
+				continue;
+			}
+			LoopBlock *x = this->Find(pred);
+			if (x->inPool != w->first) {
+				x->inPool = w->first;
+				this->pool.push_back(x);
+			}
+		}
+		STAT(c = ticks(); st->cycles[LoopStats::StepD] += c - c1; c1 = c;)
+
+		// Grow it backward to w.
+		for (int k = 0; k < this->pool.size(); k++) {
+			LoopBlock *x = this->pool[k];
+			for (int j = g->inOff[x->name]; j < g->inOff[x->name+1]; j++) {
+				LoopBlock *y = &this->loopBlock[g->in[j]];
+				if (y->first == Unvisited)
+					continue;	// dead block
+				y = this->Find(y);
+				if (y != w && y->inPool != w->first) {
+					y->inPool = w->first;
+					this->pool.push_back(y);
+				}
+			}
+		}
+		STAT(
+			c = ticks();
+			st->cycles[LoopStats::StepE] += c - c1;
+			c1 = c;
+			if (pool.size() > 0) {
+				st->pools++;
+				st->poolBlocks += pool.size();
+				st->maxPool = max(st->maxPool, (int64_t)pool.size());
+			}
+			st->irreducible += w->type == LoopBlock::Irreducible;
+			st->self += w->type == LoopBlock::Self;
+		)
+
+		this->collapse(w, lsg);
+		STAT(st->cycles[LoopStats::Collapse] += ticks() - c1;)
+	}
+	STAT(uint64_t c1 = ticks();)
+	lsg->CalculateNesting();
+	STAT(
+		st->cycles[LoopStats::Collapse] += ticks() - c1;
+		st->Count(LoopStats::StepC, pc, pv);
+		st->Finish(t0, this->uf);
+	)
+	return true;
+}
+
+// Batch analysis of many independent CFGs in parallel.
+// Each worker thread has its own LoopFinder, reused for all the
+// graphs it analyses, and the workers balance the load by stealing
+// graphs from each other.
+
+class BatchLoopFinder {
+public:
+	vector<LoopFinder> finder;
+
+	void FindLoops(FrozenCFG **g, LoopGraph **lsg, int n, int nthread);
+};
+
+// FindLoops analyses g[i] into lsg[i] for each i < n.
+
+void BatchLoopFinder::FindLoops(FrozenCFG **g, LoopGraph **lsg, int n, int nthread) {
+	if (nthread < 1)
+		nthread = 1;
+	if (this->finder.size() < nthread)
+		this->finder.resize(nthread);
+	LoopFinder *finder = &this->finder[0];
+	ParallelFor(n, nthread, [=](int w, int i) {
+		finder[w].FindLoops(g[i], lsg[i]);
+	});
+}
+
+// Incremental analysis of a CFG that changes an edge at a time.
+// IncrementalLoopFinder keeps a LoopFinder's state between changes:
+// the depth first numbering, the predecessor lists, the union-find
+// sets and the loop graph. Connect, Disconnect and Kill change the
+// graph and the loops at once; Update finishes the job, which may
+// mean compacting the graph and running FindLoops from scratch.
+//
+// Most changes leave the numbering as it is. A new edge u -> v does
+// if the search had visited v by the time it reached the end of u's
+// out list, so would not follow it; a removed edge does unless it is
+// the tree edge into v, and even then the search is the same but for
+// v's subtree if nothing else reaches the subtree. The only loops
+// such a change can affect contain v, or are headed by it, and
+// those loops only grow when edges are added or shrink when they
+// are removed. A loop containing a block below such a loop's header
+// in the depth first tree contains the header too, so the other
+// loops keep their bodies and their collapsed sets, and only the
+// blocks of the outermost loops containing v need to be taken apart
+// and collapsed again, as retake does. Changes involving unreachable
+// blocks change nothing. Anything else costs a full FindLoops.
+
+struct IncrementalStats {
+	int64_t updates;	// calls to Update
+	int64_t full;	// updates that ran FindLoops
+	int64_t added;	// edges added
+	int64_t removed;	// edges removed
+	int64_t killed;	// blocks killed
+	int64_t dead;	// changes to edges from unreachable blocks
+	int64_t trivial;	// changes that could affect no loop
+	int64_t local;	// changes that redid the loops around their target
+	int64_t cutoffs;	// removed tree edges that cut off a subtree
+	int64_t headers;	// headers redone by local changes
+	int64_t blocks;	// blocks taken apart by local changes
+	int64_t compactions;	// calls to LoopGraph::Compact
+	int64_t graphCompactions;	// calls to CFG::Compact
+
+	IncrementalStats() { memset(this, 0, sizeof *this); }
+	void Print(FILE*);
+};
+
+void IncrementalStats::Print(FILE *f) {
+	fprintf(f, "# of updates: %lld, full runs: %lld, graph compactions: %lld\n",
+		(long long)this->updates, (long long)this->full, (long long)this->graphCompactions);
+	fprintf(f, "# of edges added: %lld, removed: %lld, blocks killed: %lld\n",
+		(long long)this->added, (long long)this->removed, (long long)this->killed);
+	fprintf(f, "# of local changes: %lld, trivial: %lld, dead: %lld, cut off subtrees: %lld\n",
+		(long long)this->local, (long long)this->trivial, (long long)this->dead,
+		(long long)this->cutoffs);
+	fprintf(f, "# of headers redone: %lld, blocks: %lld (%.1f per local change), compactions: %lld\n",
+		(long long)this->headers, (long long)this->blocks,
+		this->local ? (double)this->blocks / this->local : 0.0,
+		(long long)this->compactions);
+}
+
+class IncrementalLoopFinder {
+public:
+	CFG *g;
+	LoopFinder lf;	// Havlak's engine: the others keep no predecessor lists
+	LoopGraph lsg;
+	IncrementalStats stats;
+
+	IncrementalLoopFinder(CFG *g) : g(g), stale(true), budget(0) {}
+	void FindLoops();
+	void Connect(Block*, Block*);
+	bool Disconnect(Block*, Block*);
+	bool Kill(Block*);
+	void Update();
+
+private:
+	bool stale;	// the loops need a full run
+	int64_t budget;	// blocks to take apart before a full run is cheaper
+	vector<LoopBlock*> seed;	// blocks whose loops retake redoes
+	vector<int> top;	// outermost loops containing seeds
+	vector<int> kept;	// other loops in the region
+	vector<int> region;	// blocks taken apart
+	vector<int> work;
+	vector<LoopBlock*> redo;	// headers to redo
+
+	LoopBlock *block(Block*);
+	bool cutOff(LoopBlock*, LoopBlock*);
+	void relist(LoopBlock*);
+	void retake();
+};
+
+// FindLoops analyses the whole graph from scratch.
+
+void IncrementalLoopFinder::FindLoops() {
+	this->lf.FindLoops(this->g, &this->lsg);
+	this->stale = false;
+	this->budget = this->lf.depthFirst.size();
+}
+
+// Update brings the loops up to date. Edges into a big loop take
+// most of the graph apart, so once the changes since the last
+// Update have taken apart more blocks than are reachable, a full
+// run is cheaper, and the changes after that are left to it. The
+// graph is compacted when killed blocks outnumber live ones, which
+// renames the blocks and so needs a full run too.
+
+void IncrementalLoopFinder::Update() {
+	this->stats.updates++;
+	if (this->g->ndeadBlock > this->g->block.size() - this->g->ndeadBlock) {
+		this->g->Compact();
+		this->stats.graphCompactions++;
+		this->stale = true;
+	}
+	if (this->stale) {
+		this->stats.full++;
+		this->FindLoops();
+	}
+	this->budget = this->lf.depthFirst.size();
+}
+
+// block returns b's state, or NULL if b is new since the last
+// full run, or the loops are stale.
+
+LoopBlock *IncrementalLoopFinder::block(Block *b) {
+	if (this->stale || b->name >= this->lf.loopBlock.size())
+		return NULL;
+	return &this->lf.loopBlock[b->name];
+}
+
+// Connect adds the edge src -> dst.
+
+void IncrementalLoopFinder::Connect(Block *src, Block *dst) {
+	this->g->Connect(src, dst);
+	this->stats.added++;
+	if (this->stale)
+		return;
+	LoopBlock *u = this->block(src);
+	LoopBlock *v = this->block(dst);
+	if (u == NULL || u->first == Unvisited) {
+		this->stats.dead++;
+		return;
+	}
+	if (v == NULL || v->first == Unvisited || (v->first > u->first && !u->IsAncestor(v)) || this->budget < 0) {
+		this->stale = true;
+		return;
+	}
+
+	// Another way into a block in no loop, or into a loop
+	// from inside it, changes nothing.
+	int inner = this->lsg.InnermostLoop(v->name);
+	if (!v->IsAncestor(u) && (inner == 0 || this->lsg.InLoop(u->name, inner))) {
+		v->nonBackPred.push_back(u);
+		this->stats.trivial++;
+		return;
+	}
+	this->seed.clear();
+	this->seed.push_back(v);
+	this->retake();
+}
+
+// Disconnect removes the last edge from src to dst,
+// and reports whether there was one.
+
+bool IncrementalLoopFinder::Disconnect(Block *src, Block *dst) {
+	if (!this->g->Disconnect(src, dst))
+		return false;
+	this->stats.removed++;
+	if (this->stale)
+		return true;
+	LoopBlock *u = this->block(src);
+	LoopBlock *v = this->block(dst);
+	if (u == NULL || u->first == Unvisited) {
+		this->stats.dead++;
+		return true;
+	}
+	if (this->budget < 0) {
+		this->stale = true;
+		return true;
+	}
+
+	// The tree edge into v is the first edge to it from its parent.
+	LoopFinder *lf = &this->lf;
+	if (v->first > 1 && lf->depthFirst[lf->dfsParent[v->first-1]] == u &&
+	    find(src->out.begin(), src->out.end(), dst) == src->out.end()) {
+		if (!this->cutOff(u, v))
+			this->stale = true;
+		return true;
+	}
+
+	// One less way into a block in no loop changes nothing.
+	if (!v->IsAncestor(u) && this->lsg.InnermostLoop(v->name) == 0) {
+		vector<LoopBlock*> &nbp = v->nonBackPred;
+		vector<LoopBlock*>::reverse_iterator it = find(nbp.rbegin(), nbp.rend(), u);
+		if (it != nbp.rend())
+			nbp.erase(it.base() - 1);
+		this->stats.trivial++;
+		return true;
+	}
+	this->seed.clear();
+	this->seed.push_back(v);
+	this->retake();
+	return true;
+}
+
+// Kill removes b's edges, one at a time, and marks it dead.
+// Like CFG::Kill, it refuses to kill the entry block.
+
+bool IncrementalLoopFinder::Kill(Block *b) {
+	if (b == this->g->block[0])
+		return false;
+	while (!b->out.empty())
+		this->Disconnect(b, b->out.back());
+	while (!b->in.empty())
+		this->Disconnect(b->in.back(), b);
+	this->g->Kill(b);
+	this->stats.killed++;
+	return true;
+}
+
+// cutOff handles the removal of the tree edge u -> v, if nothing
+// else now reaches v's subtree, and otherwise reports false. The
+// subtree's blocks become unreachable, leaving holes in the
+// numbering, and the loops headed in it die. The loops around u,
+// and around the targets of edges leaving the subtree, are redone.
+
+bool IncrementalLoopFinder::cutOff(LoopBlock *u, LoopBlock *v) {
+	LoopFinder *lf = &this->lf;
+	int lo = v->first;
+	int hi = v->last;
+	for (int i = lo-1; i < hi; i++) {
+		LoopBlock *z = lf->depthFirst[i];
+		if (z->first == Unvisited)
+			continue;	// cut off before
+		Block *b = this->g->block[z->name];
+		for (int j = 0; j < b->in.size(); j++) {
+			LoopBlock *y = this->block(b->in[j]);
+			if (y != NULL && y->first != Unvisited && (y->first < lo || y->first > hi))
+				return false;
+		}
+	}
+	this->stats.cutoffs++;
+
+	this->seed.clear();
+	this->seed.push_back(u);
+	for (int i = lo-1; i < hi; i++) {
+		LoopBlock *z = lf->depthFirst[i];
+		if (z->first == Unvisited)
+			continue;
+		if (z->loop != 0)
+			this->lsg.Kill(z->loop);
+		z->loop = 0;
+		this->lsg.blockLoop[z->name] = 0;
+		Block *b = this->g->block[z->name];
+		for (int j = 0; j < b->out.size(); j++) {
+			LoopBlock *x = this->block(b->out[j]);
+			if (x != NULL && x->first != Unvisited && (x->first < lo || x->first > hi))
+				this->seed.push_back(x);
+		}
+	}
+	for (int i = lo-1; i < hi; i++) {
+		LoopBlock *z = lf->depthFirst[i];
+		z->first = Unvisited;
+		z->type = LoopBlock::Dead;
+	}
+	this->budget -= hi - lo + 1;
+	this->retake();
+	return true;
+}
+
+// relist rebuilds w's predecessor lists from the graph as Step B
+// would, dropping the blocks Step E added to them.
+
+void IncrementalLoopFinder::relist(LoopBlock *w) {
+	for (int i = 0; i < w->nonBackPred.size(); i++) {
+		LoopBlock *y = w->nonBackPred[i];
+		if (y->inNonBackPred == w->first)
+			y->inNonBackPred = Unvisited;
+	}
+	w->backPred.clear();
+	w->nonBackPred.clear();
+	Block *b = this->g->block[w->name];
+	for (int i = 0; i < b->in.size(); i++) {
+		LoopBlock *y = this->block(b->in[i]);
+		if (y == NULL || y->first == Unvisited)
+			continue;	// dead block
+		if (w->IsAncestor(y))
+			w->backPred.push_back(y);
+		else
+			w->nonBackPred.push_back(y);
+	}
+}
+
+// retake redoes the loops containing the seed blocks, and those
+// they head, once the change to the graph has been made. It kills
+// the loops, takes apart the blocks of the outermost ones, and
+// collapses again the other loops among them, which it keeps.
+// Then it redoes the killed loops' headers and the seeds, in
+// reverse depth first order, with fresh predecessor lists.
+
+void IncrementalLoopFinder::retake() {
+	LoopFinder *lf = &this->lf;
+	LoopGraph *lsg = &this->lsg;
+	LoopBlock *base = &lf->loopBlock[0];
+	this->stats.local++;
+
+	// Kill the loops containing each seed, up to the root or
+	// a loop killed for an earlier seed.
+	this->redo.clear();
+	this->top.clear();
+	this->region.clear();
+	for (int i = 0; i < this->seed.size(); i++) {
+		LoopBlock *s = this->seed[i];
+		this->redo.push_back(s);
+		int l = lsg->blockLoop[s->name];
+		if (l == 0)
+			this->region.push_back(s->name);
+		int last = 0;
+		for (; l != 0 && !lsg->loop[l].isDead; l = lsg->loop[l].parent) {
+			LoopBlock *w = base + lsg->loop[l].head;
+			w->loop = 0;
+			w->type = LoopBlock::NonHeader;
+			lsg->Kill(l);
+			this->redo.push_back(w);
+			last = l;
+		}
+		if (l == 0 && last != 0)
+			this->top.push_back(last);
+	}
+
+	// The region is the blocks of the outermost killed loops. The
+	// loops in it still alive are kept; those headed by unreachable
+	// blocks, killed by cutOff, are skipped.
+	this->kept.clear();
+	this->work = this->top;
+	while (!this->work.empty()) {
+		int l = this->work.back();
+		this->work.pop_back();
+		Loop *lp = &lsg->loop[l];
+		if (base[lp->head].first == Unvisited)
+			continue;
+		for (int j = lp->blockOff; j < lp->blockEnd; j++) {
+			int b = lsg->block[j];
+			if (base[b].first == Unvisited)
+				continue;
+			this->region.push_back(b);
+			if (lp->isDead)
+				lsg->blockLoop[b] = 0;	// until it is added to a new loop
+		}
+		if (!lp->isDead) {
+			this->kept.push_back(l);
+			if (lsg->loop[lp->parent].isDead)
+				lp->parent = 0;	// until a new loop collapses it
+		}
+		for (int c = lp->firstChild; c != 0; c = lsg->loop[c].nextSibling)
+			this->work.push_back(c);
+	}
+	for (int i = 0; i < this->region.size(); i++) {
+		lf->uf.Reset(this->region[i]);
+		base[this->region[i]].inPool = Unvisited;
+	}
+
+	// Collapse the kept loops again, inner loops first.
+	sort(this->kept.begin(), this->kept.end());
+	for (int i = 0; i < this->kept.size(); i++) {
+		Loop *l = &lsg->loop[this->kept[i]];
+		for (int j = l->blockOff+1; j < l->blockEnd; j++)
+			lf->uf.Union(lsg->block[j], l->head);
+		for (int c = l->firstChild; c != 0; c = lsg->loop[c].nextSibling)
+			lf->uf.Union(lsg->loop[c].head, l->head);
+	}
+
+	// Redo the headers, innermost first.
+	sort(this->redo.begin(), this->redo.end(), [](LoopBlock *a, LoopBlock *b) {
+		return a->first > b->first;
+	});
+	this->redo.erase(unique(this->redo.begin(), this->redo.end()), this->redo.end());
+	for (int i = 0; i < this->redo.size(); i++) {
+		LoopBlock *w = this->redo[i];
+		this->relist(w);
+		if (w->backPred.size() > 0)
+			lf->findLoop(w, lsg);
+	}
+	this->stats.headers += this->redo.size();
+	this->stats.blocks += this->region.size();
+	this->budget -= this->region.size();
+
+	if (lsg->ndead > lsg->NumLoops()) {
+		lsg->Compact();
+		for (int l = 1; l < lsg->loop.size(); l++)
+			base[lsg->loop[l].head].loop = l;
+		this->stats.compactions++;
+	} else {
+		lsg->CalculateNesting();
+	}
+}
+
+// eval returns the vertex with the least semidominator on the path
+// from v up to the root of its tree in the forest built so far,
+// compressing the path on the way.
+
+int DomTree::eval(int v) {
+	int *ancestor = &this->ancestor[0];
+	int *label = &this->label[0];
+	int *semi = &this->semi[0];
+	if (ancestor[v] < 0)
+		return v;
+	this->path.clear();
+	for (int x = v; ancestor[ancestor[x]] >= 0; x = ancestor[x])
+		this->path.push_back(x);
+	for (int i = this->path.size() - 1; i >= 0; i--) {
+		int x = this->path[i];
+		int a = ancestor[x];
+		if (semi[label[a]] < semi[label[x]])
+			label[x] = label[a];
+		ancestor[x] = ancestor[a];
+	}
+	return label[v];
+}
+
+// Build computes the dominator tree of g, which lf must have
+// numbered, by FindLoops or by Init and Number.
+
+void DomTree::Build(FrozenCFG *g, LoopFinder *lf) {
+	int nblock = g->nblock;
+	int n = lf->depthFirst.size();
+	LoopBlock **df = &lf->depthFirst[0];
+	int *parent = &lf->dfsParent[0];
+	this->idom.assign(nblock, -1);
+	this->pre.resize(nblock);
+	this->post.resize(nblock);
+	if (n == 0)
+		return;
+	this->semi.resize(n);
+	this->label.resize(n);
+	this->ancestor.assign(n, -1);
+	this->dom.resize(n);
+	this->size.assign(n, 1);
+	int *semi = &this->semi[0];
+	int *dom = &this->dom[0];
+	for (int v = 0; v < n; v++) {
+		semi[v] = v;
+		this->label[v] = v;
+	}
+
+	// Copy the numbering into dense arrays, which the loops
+	// below read far more cheaply than the LoopBlocks.
+	this->num.assign(nblock, -1);
+	this->name.resize(n);
+	int *num = &this->num[0];
+	int *name = &this->name[0];
+	for (int v = 0; v < n; v++) {
+		name[v] = df[v]->name;
+		num[name[v]] = v;
+	}
+
+	// Semidominators, in reverse depth first order. A predecessor
+	// numbered before w is its own eval; the others have been
+	// linked into the forest already.
+	for (int w = n-1; w > 0; w--) {
+		int b = name[w];
+		for (int j = g->inOff[b]; j < g->inOff[b+1]; j++) {
+			int u = num[g->in[j]];
+			if (u < 0)
+				continue;	// dead predecessor
+			int s = semi[this->eval(u)];
+			if (s < semi[w])
+				semi[w] = s;
+		}
+		this->ancestor[w] = parent[w];
+	}
+
+	// Immediate dominators: the nearest common ancestor of the
+	// semidominator and the parent, found by walking up from the
+	// parent. Dominators come first in depth first order, so each
+	// walk only visits finished vertices.
+	dom[0] = -1;
+	for (int w = 1; w < n; w++) {
+		int d = parent[w];
+		while (d > semi[w])
+			d = dom[d];
+		dom[w] = d;
+	}
+
+	// Number the tree as LoopGraph::CalculateNesting does, here with
+	// parents before children: subtree sizes going up, then each
+	// child's subtree starts after its earlier siblings'. Children
+	// of one vertex are numbered in depth first order without any
+	// child lists, by handing each the next free number of its
+	// parent, kept in semi once that is no longer needed.
+	int *sz = &this->size[0];
+	for (int w = n-1; w > 0; w--)
+		sz[dom[w]] += sz[w];
+	vector<int> &depth = this->label;	// done with labels
+	vector<int> &next = this->semi;	// and semidominators
+	depth[0] = 0;
+	this->pre[name[0]] = 0;
+	next[0] = 1;
+	for (int w = 1; w < n; w++) {
+		int d = dom[w];
+		int p = next[d];
+		next[d] += sz[w];
+		next[w] = p + 1;
+		depth[w] = depth[d] + 1;
+		this->pre[name[w]] = p;
+	}
+	for (int w = 0; w < n; w++) {
+		int b = name[w];
+		this->post[b] = this->pre[b] + sz[w] - 1 - depth[w];
+		if (w > 0)
+			this->idom[b] = name[dom[w]];
+	}
+
+	// Dead blocks get numbers of their own after the tree.
+	int k = n;
+	for (int b = 0; b < nblock; b++) {
+		if (num[b] < 0) {
+			this->pre[b] = k;
+			this->post[b] = k;
+			k++;
+		}
+	}
+}
+
+// Main program.
+
+// BenchBatch analyses a batch of n graphs of assorted sizes
+// with 1, 2, ..., maxthread threads and reports the time taken.
+// It also checks that every thread count produces exactly the
+// same loop graphs; built with -fsanitize=thread (make
+// havlak6cc.race) it doubles as a stress test for data races.
+
+void BenchBatch(int n, int maxthread) {
+	vector<FrozenCFG*> g(n);
+	long long nblock = 0;
+	for (int i = 0; i < n; i++) {
+		CFG *cfg = BuildLoopTrees(1 + i%4, 1 + i*37%50, 1 + i*13%25);
+		g[i] = new FrozenCFG;
+		g[i]->Freeze(cfg);
+		nblock += g[i]->nblock;
+		delete cfg;
+	}
+	printf("batch: %d graphs, %lld blocks\n", n, nblock);
+
+	BatchLoopFinder f;
+	vector<uint64_t> want(n);
+	for (int t = 1; t <= maxthread; t++) {
+		vector<LoopGraph*> lsg(n);
+		for (int i = 0; i < n; i++)
+			lsg[i] = new LoopGraph;
+		double t0 = now();
+		f.FindLoops(&g[0], &lsg[0], n, t);
+		double dt = now() - t0;
+		long long nloop = 0;
+		int differ = 0;
+		for (int i = 0; i < n; i++) {
+			nloop += lsg[i]->NumLoops();
+			uint64_t h = lsg[i]->Hash();
+			if (t == 1)
+				want[i] = h;
+			else if (h != want[i])
+				differ++;
+			delete lsg[i];
+		}
+		printf("threads: %d, %.3fs, %.0f graphs/s, %lld loops\n", t, dt, n/dt, nloop);
+		if (differ > 0)
+			printf("threads: %d: %d graphs differ from single-threaded run\n", t, differ);
+	}
+	for (int i = 0; i < n; i++)
+		delete g[i];
+}
+
+// BenchBuild builds the benchmark graph's edges, repeated copies
+// times, with each copy entered from the exit of the one before,
+// and times building a FrozenCFG from them with nthread threads.
+// If file is not NULL, it then writes the graph to file.
+
+void BenchBuild(int copies, int nthread, bool dedup, const char *file) {
+	CFG *cfg = BuildGraph();
+	int n = cfg->block.size();
+	int m = cfg->edge.size();
+	long long nedge = (long long)copies * (m+1) - 1;
+	if ((long long)copies * n > 0x7fffffff || nedge > 0x7fffffff) {
+		fprintf(stderr, "-build=%d: graph too large\n", copies);
+		exit(2);
+	}
+	vector<int> src(nedge);
+	vector<int> dst(nedge);
+	long long k = 0;
+	for (int c = 0; c < copies; c++) {
+		if (c > 0) {
+			src[k] = (c-1)*n + 1;
+			dst[k] = c*n;
+			k++;
+		}
+		for (int i = 0; i < m; i++) {
+			src[k] = c*n + cfg->edge[i].src;
+			dst[k] = c*n + cfg->edge[i].dst;
+			k++;
+		}
+	}
+	delete cfg;
+
+	FrozenCFG g;
+	double t0 = now();
+	g.Build(copies*n, &src[0], &dst[0], nedge, nthread, dedup);
+	double dt = now() - t0;
+	printf("build: %d blocks, %lld edges, %d threads: %.3fs, %.0f edges/s\n",
+		g.nblock, nedge, nthread, dt, nedge/dt);
+	if (file != NULL && !g.Write(file))
+		exit(1);
+}
+
+// ReadEdges reads every function in an edge list file and
+// analyses each one, reporting totals and the time taken.
+
+void ReadEdges(const char *file, int nthread, int chunk) {
+	FILE *f = stdin;
+	if (strcmp(file, "-") != 0)
+		f = fopen(file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		exit(1);
+	}
+
+	double t0 = now();
+	EdgeListReader r(f, file, nthread, chunk);
+	LoopFinder lf;
+	FrozenCFG g;
+	LoopGraph lsg;
+	string name;
+	int nfunc = 0;
+	long long nblock = 0, nedge = 0, nloop = 0;
+	while (r.Next(&g, &name)) {
+		lf.FindLoops(&g, &lsg);
+		nfunc++;
+		nblock += g.nblock;
+		nedge += g.nedge;
+		nloop += lsg.NumLoops();
+	}
+	if (r.failed)
+		exit(1);
+	if (f != stdin)
+		fclose(f);
+	printf("edges: %d functions, %lld blocks, %lld edges, %lld loops: %.3fs\n",
+		nfunc, nblock, nedge, nloop, now() - t0);
+}
+
+// BenchLoops analyses g warmup times and then iterations more,
+// timing each of those, and reports the times in format. Each
+// iteration analyses nthread copies of g at once, one per thread.
+// Other output goes to stdout with the text format and to stderr
+// otherwise, leaving stdout machine-readable.
+// Each thread reuses one loop graph throughout.
+// It returns the last loop graph built.
+
+LoopGraph *BenchLoops(FrozenCFG *g, const char *graph, const char *engine,
+	int warmup, int iterations, int nthread, const char *format, bool findstats, bool counters) {
+	BatchLoopFinder f;
+	f.finder.resize(nthread);
+	for (int i = 0; i < nthread; i++) {
+		f.finder[i].recursive = strcmp(engine, "recursive") == 0;
+		f.finder[i].natural = strcmp(engine, "natural") == 0;
+		f.finder[i].counters = counters;
+	}
+	vector<FrozenCFG*> gs(nthread, g);
+	vector<LoopGraph*> lsg(nthread);
+	for (int j = 0; j < nthread; j++)
+		lsg[j] = new LoopGraph;
+	vector<double> times;
+	LoopStats stats;
+	for (int i = 0; i < warmup + iterations; i++) {
+		double t0 = now();
+		f.FindLoops(&gs[0], &lsg[0], nthread, nthread);
+		double t = now() - t0;
+		if (i >= warmup)
+			times.push_back(t);
+		for (int j = 0; j < nthread; j++)
+			stats.Add(lsg[j]->stats);
+	}
+	for (int j = 1; j < nthread; j++)
+		delete lsg[j];
+	LoopGraph *last = lsg[0];
+
+	FILE *log = strcmp(format, "text") == 0 ? stdout : stderr;
+	if (counters && stats.counted == 0)
+		fprintf(stderr, "hardware counters unavailable; timing only\n");
+	fprintf(log, "# of loops: %d (including 1 artificial root node)\n", last->NumLoops());
+	if (findstats)
+		stats.Print(log);
+	BenchInfo b = {"havlak6cc", engine, graph, g->nblock, g->nedge,
+		last->NumLoops(), nthread, warmup};
+	BenchReport(stdout, format, b, times);
+	return last;
+}
+
+// BenchQueries times n random queries of each kind on lsg, a loop
+// graph of a CFG with nblock blocks, and reports the rates to log.
+// The times include drawing the random arguments. It checks the
+// first queries against walks up the loop tree.
+
+void BenchQueries(LoopGraph *lsg, int nblock, int n, uint64_t seed, FILE *log) {
+	GenRand r(seed);
+	int nloop = lsg->loop.size();
+	long long hits = 0;
+	int wrong = 0;
+	for (int i = 0; i < n && i < 10000; i++) {
+		int b = r.Intn(nblock);
+		int l = r.Intn(nloop);
+		bool want = false;
+		for (int x = lsg->InnermostLoop(b); x >= 0; x = lsg->loop[x].parent)
+			want |= x == l;
+		wrong += lsg->InLoop(b, l) != want;
+	}
+
+	double t0 = now();
+	for (int i = 0; i < n; i++)
+		hits += lsg->InnermostLoop(r.Intn(nblock)) != 0;
+	double t1 = now();
+	for (int i = 0; i < n; i++) {
+		int b = r.Intn(nblock);
+		hits += lsg->InLoop(b, r.Intn(nloop));
+	}
+	double t2 = now();
+	for (int i = 0; i < n; i++) {
+		int a = r.Intn(nloop);
+		hits += lsg->Nested(a, r.Intn(nloop));
+	}
+	double t3 = now();
+	fprintf(log, "queries: %d each, innermost %.1fM/s, inloop %.1fM/s, nested %.1fM/s (%lld hits)\n",
+		n, n/(t1-t0)/1e6, n/(t2-t1)/1e6, n/(t3-t2)/1e6, hits);
+	if (wrong > 0)
+		fprintf(log, "queries: %d wrong answers\n", wrong);
+}
+
+// sameLoops reports whether a and b hold the same forest,
+// however their loops are numbered and their blocks ordered.
+
+bool sameLoops(LoopGraph *a, LoopGraph *b) {
+	vector<CanonLoop> ca, cb;
+	a->Canon(&ca);
+	b->Canon(&cb);
+	if (ca.size() != cb.size())
+		return false;
+	for (int i = 0; i < ca.size(); i++) {
+		if (ca[i].head != cb[i].head || ca[i].parent != cb[i].parent ||
+		    ca[i].reducible != cb[i].reducible || ca[i].block != cb[i].block)
+			return false;
+	}
+	return true;
+}
+
+// incrementalReport reports the times of a run of incremental
+// updates to g, the statistics, and the time of a full FindLoops.
+
+void incrementalReport(FILE *log, const char *name, const char *graph, const char *what,
+	CFG *g, vector<double> times, IncrementalStats *stats) {
+	LoopFinder f;
+	LoopGraph lsg;
+	vector<double> full;
+	for (int i = 0; i < 5; i++) {
+		double t0 = now();
+		f.FindLoops(g, &lsg);
+		full.push_back(now() - t0);
+	}
+	sort(times.begin(), times.end());
+	sort(full.begin(), full.end());
+	double med = benchPercentile(times, 50);
+	fprintf(log, "%s %s: %s, median %.3fms, p99 %.3fms, max %.3fms; full run %.3fms (%.0fx)\n",
+		name, graph, what, med * 1e3, benchPercentile(times, 99) * 1e3,
+		times.empty() ? 0.0 : times.back() * 1e3, full[2] * 1e3, med > 0 ? full[2] / med : 0.0);
+	stats->Print(log);
+}
+
+// BenchIncremental holds back iterations*batch random edges of g
+// and adds them back with an IncrementalLoopFinder, batch edges per
+// Update, comparing the time per batch with a full FindLoops. The
+// edges held back include the depth first tree edges into a few
+// random blocks, cutting off their subtrees, so that some updates
+// take each path. The loops are checked against full runs at ten
+// points along the way, and BenchIncremental exits if they differ.
+
+void BenchIncremental(FrozenCFG *g, const char *graph, int batch, int iterations, uint64_t seed, FILE *log) {
+	LoopFinder ref;
+	LoopGraph lsg;
+	ref.FindLoops(g, &lsg);
+
+	// The tree edge into each block is the first edge to it from its
+	// parent. Adding the tree edges first, in depth first order, keeps
+	// each parent's children in order, so the search numbers the tree
+	// as ref did until held back edges are added.
+	GenRand r(seed);
+	vector<int> treeEdge(ref.depthFirst.size(), -1);
+	vector<char> tree(g->nedge);
+	for (int i = 1; i < ref.depthFirst.size(); i++) {
+		int b = ref.depthFirst[i]->name;
+		int j = g->outOff[ref.depthFirst[ref.dfsParent[i]]->name];
+		while (g->out[j] != b)
+			j++;
+		treeEdge[i] = j;
+		tree[j] = 1;
+	}
+	vector<Edge> edge;
+	for (int b = 0; b < g->nblock; b++)
+		for (int j = g->outOff[b]; j < g->outOff[b+1]; j++)
+			if (!tree[j])
+				edge.push_back(Edge(b, g->out[j]));
+	for (int i = edge.size() - 1; i > 0; i--)
+		swap(edge[i], edge[r.Intn(i+1)]);
+	int keep = max(0, (int)edge.size() - iterations*batch);
+	for (int k = 0; k < 8 && ref.depthFirst.size() > 1; k++) {
+		int i = 1 + r.Intn(ref.depthFirst.size() - 1);
+		if (tree[treeEdge[i]]) {
+			tree[treeEdge[i]] = 0;
+			edge.push_back(Edge(ref.depthFirst[ref.dfsParent[i]]->name, ref.depthFirst[i]->name));
+			swap(edge.back(), edge[keep + r.Intn(edge.size() - keep)]);
+		}
+	}
+
+	CFG cfg;
+	for (int b = 0; b < g->nblock; b++)
+		cfg.NewBlock();
+	for (int i = 1; i < ref.depthFirst.size(); i++) {
+		if (tree[treeEdge[i]])
+			cfg.Connect(cfg.block[ref.depthFirst[ref.dfsParent[i]]->name], cfg.block[ref.depthFirst[i]->name]);
+	}
+	for (int i = 0; i < keep; i++)
+		cfg.Connect(cfg.block[edge[i].src], cfg.block[edge[i].dst]);
+
+	IncrementalLoopFinder inc(&cfg);
+	inc.FindLoops();
+	vector<double> times;
+	int nupdate = (edge.size() - keep + batch - 1) / batch;
+	int every = (nupdate + 9) / 10;
+	for (int k = 0; k < nupdate; k++) {
+		double t0 = now();
+		for (int i = keep + k*batch; i < keep + (k+1)*batch && i < edge.size(); i++)
+			inc.Connect(cfg.block[edge[i].src], cfg.block[edge[i].dst]);
+		inc.Update();
+		times.push_back(now() - t0);
+		if ((k+1) % every == 0 || k+1 == nupdate) {
+			ref.FindLoops(&cfg, &lsg);
+			if (!sameLoops(&inc.lsg, &lsg)) {
+				fprintf(stderr, "incremental: loops differ from full run after %d updates\n", k+1);
+				exit(1);
+			}
+		}
+	}
+
+	char what[64];
+	snprintf(what, sizeof what, "%d batches of %d edges", nupdate, batch);
+	incrementalReport(log, "incremental", graph, what, &cfg, times, &inc.stats);
+}
+
+// BenchChurn makes n random changes to a copy of g with an
+// IncrementalLoopFinder, timing each change and the Update after
+// it, and compares them with a full FindLoops. The changes mimic an
+// optimiser deleting branches and dead code: 45% remove a random
+// edge, 45% add back a removed edge, and 10% kill a random block.
+// The loops are checked against full runs at ten points along the
+// way, and BenchChurn exits if they differ.
+
+void BenchChurn(FrozenCFG *g, const char *graph, int n, uint64_t seed, FILE *log) {
+	CFG cfg;
+	for (int b = 0; b < g->nblock; b++)
+		cfg.NewBlock();
+	for (int b = 0; b < g->nblock; b++)
+		for (int j = g->outOff[b]; j < g->outOff[b+1]; j++)
+			cfg.Connect(cfg.block[b], cfg.block[g->out[j]]);
+
+	IncrementalLoopFinder inc(&cfg);
+	inc.FindLoops();
+	GenRand r(seed);
+	vector<pair<Block*, Block*> > removed;
+	vector<double> times;
+	LoopFinder ref;
+	LoopGraph lsg;
+	int every = (n + 9) / 10;
+	for (int k = 0; k < n; k++) {
+		// Pick the change first, so that only making it is timed.
+		int op = r.Intn(20);
+		Block *src = NULL, *dst = NULL;
+		if (op < 18 && (op < 9 || removed.empty())) {
+			for (int try_ = 0; try_ < 100 && src == NULL; try_++) {
+				Block *b = cfg.block[r.Intn(cfg.block.size())];
+				if (!b->out.empty())
+					src = b;
+			}
+			if (src != NULL)
+				dst = src->out[r.Intn(src->out.size())];
+			op = 0;
+		} else if (op < 18) {
+			int i = r.Intn(removed.size());
+			src = removed[i].first;
+			dst = removed[i].second;
+			removed[i] = removed.back();
+			removed.pop_back();
+			if (src->dead || dst->dead)
+				src = NULL;
+			op = 1;
+		} else if (cfg.block.size() > 1) {
+			src = cfg.block[1 + r.Intn(cfg.block.size() - 1)];
+			if (src->dead)
+				src = NULL;
+			op = 2;
+		}
+
+		int64_t compactions = inc.stats.graphCompactions;
+		double t0 = now();
+		if (src != NULL) {
+			if (op == 0)
+				inc.Disconnect(src, dst);
+			else if (op == 1)
+				inc.Connect(src, dst);
+			else
+				inc.Kill(src);
+		}
+		inc.Update();
+		times.push_back(now() - t0);
+		if (op == 0 && src != NULL)
+			removed.push_back(make_pair(src, dst));
+		if (inc.stats.graphCompactions != compactions)
+			removed.clear();	// killed blocks are gone
+
+		if ((k+1) % every == 0 || k+1 == n) {
+			ref.FindLoops(&cfg, &lsg);
+			if (!sameLoops(&inc.lsg, &lsg)) {
+				fprintf(stderr, "churn: loops differ from full run after %d changes\n", k+1);
+				exit(1);
+			}
+		}
+	}
+	char what[64];
+	snprintf(what, sizeof what, "%d changes", n);
+	incrementalReport(log, "churn", graph, what, &cfg, times, &inc.stats);
+}
+
+// BenchRegions builds an arena holding n copies of g, as a compiler
+// might keep every function of a program in one graph, and times
+// FindRegionLoops on copies chosen at random, reporting the times in
+// format as BenchLoops does. The natural engine has no region form,
+// so it runs Havlak's algorithm. For comparison it times FindLoops on
+// the arena, which analyses only the first copy, the one the entry
+// reaches, but marks every other block dead. It checks the first
+// regions' loops against g's own, and exits if they differ.
+
+void BenchRegions(FrozenCFG *g, const char *graph, const char *engine, int n, int warmup, int iterations,
+	const char *format, uint64_t seed, FILE *log) {
+	int size = g->nblock;
+	if (size == 0 || (long long)n * g->nedge > INT_MAX || (long long)n * size > INT_MAX) {
+		fprintf(stderr, "regions: arena of %d copies of %d blocks is too big\n", n, size);
+		exit(2);
+	}
+	FrozenCFG arena;
+	{
+		vector<int> src, dst;
+		src.reserve(n * g->nedge);
+		dst.reserve(n * g->nedge);
+		for (int i = 0; i < n; i++) {
+			for (int b = 0; b < size; b++) {
+				for (int j = g->outOff[b]; j < g->outOff[b+1]; j++) {
+					src.push_back(i*size + b);
+					dst.push_back(i*size + g->out[j]);
+				}
+			}
+		}
+		arena.Build(n*size, src.data(), dst.data(), src.size(), 1, false);
+	}
+
+	LoopFinder lf;
+	LoopGraph lsg;
+	vector<CanonLoop> want, got;
+	lf.recursive = strcmp(engine, "recursive") == 0;
+	lf.FindLoops(g, &lsg);
+	lsg.Canon(&want);
+	int nloop = lsg.NumLoops();
+
+	GenRand r(seed);
+	vector<double> times;
+	for (int i = 0; i < warmup + iterations; i++) {
+		int off = r.Intn(n) * size;
+		double t0 = now();
+		lf.FindRegionLoops(&arena, off, &lsg);
+		double t = now() - t0;
+		if (i >= warmup)
+			times.push_back(t);
+		if (i >= warmup + 10)
+			continue;
+		lsg.Canon(&got);
+		bool ok = got.size() == want.size();
+		for (int j = 0; ok && j < got.size(); j++) {
+			CanonLoop *c = &got[j];
+			for (int k = 0; k < c->block.size(); k++)
+				c->block[k] -= off;
+			ok = c->head - off == want[j].head && c->reducible == want[j].reducible &&
+				(c->parent < 0 ? -1 : c->parent - off) == want[j].parent && c->block == want[j].block;
+		}
+		if (!ok) {
+			fprintf(stderr, "regions: loops of region at %d differ from the graph's own\n", off);
+			exit(1);
+		}
+	}
+
+	double t0 = now();
+	lf.FindLoops(&arena, &lsg);
+	double whole = now() - t0;
+	fprintf(log, "regions: %d regions of %d blocks in an arena of %d blocks; FindLoops on the arena %.3fms\n",
+		n, size, arena.nblock, whole * 1e3);
+	char what[300];
+	snprintf(what, sizeof what, "regions:%d:%s", n, graph);
+	BenchInfo b = {"havlak6cc", engine, what, g->nblock, g->nedge, nloop, 1, warmup};
+	BenchReport(stdout, format, b, times);
+}
+
+// reachesAvoiding reports whether the entry of g reaches block b
+// without passing through block a.
+
+bool reachesAvoiding(FrozenCFG *g, int a, int b, vector<char> *seen, vector<int> *stack) {
+	seen->assign(g->nblock, 0);
+	stack->clear();
+	if (a == 0)
+		return false;
+	(*seen)[0] = 1;
+	stack->push_back(0);
+	while (!stack->empty()) {
+		int x = stack->back();
+		stack->pop_back();
+		if (x == b)
+			return true;
+		for (int j = g->outOff[x]; j < g->outOff[x+1]; j++) {
+			int y = g->out[j];
+			if (y != a && !(*seen)[y]) {
+				(*seen)[y] = 1;
+				stack->push_back(y);
+			}
+		}
+	}
+	return false;
+}
+
+// BenchDominators times building the dominator tree of g from
+// scratch, depth first numbering included, and reports the times
+// in format as BenchLoops does. It then checks Dominates against
+// searches of g with one block removed, for nsample random blocks
+// paired with their immediate dominators and with random blocks.
+
+void BenchDominators(FrozenCFG *g, const char *graph, int warmup, int iterations,
+	const char *format, int nsample, uint64_t seed) {
+	LoopFinder lf;
+	DomTree dt;
+	vector<double> times;
+	for (int i = 0; i < warmup + iterations; i++) {
+		double t0 = now();
+		lf.Init(g->nblock);
+		lf.Number(g);
+		dt.Build(g, &lf);
+		double t = now() - t0;
+		if (i >= warmup)
+			times.push_back(t);
+	}
+	BenchInfo b = {"havlak6cc", "dominators", graph, g->nblock, g->nedge, 0, 1, warmup};
+	BenchReport(stdout, format, b, times);
+
+	GenRand r(seed);
+	vector<char> seen;
+	vector<int> stack;
+	int wrong = 0;
+	for (int i = 0; i < nsample && g->nblock > 0; i++) {
+		int b = r.Intn(g->nblock);
+		if (lf.loopBlock[b].first == Unvisited)
+			continue;
+		int a[2] = {dt.idom[b], r.Intn(g->nblock)};
+		for (int j = 0; j < 2; j++) {
+			if (a[j] < 0 || a[j] == b)
+				continue;
+			if (dt.Dominates(a[j], b) == reachesAvoiding(g, a[j], b, &seen, &stack)) {
+				if (wrong++ < 10)
+					fprintf(stderr, "dominators: %d dominates %d is %s\n",
+						a[j], b, dt.Dominates(a[j], b) ? "true" : "false");
+			}
+		}
+	}
+	if (wrong > 0) {
+		fprintf(stderr, "dominators: %d wrong answers\n", wrong);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	int wide = 0;
+	int deep = 0;
+	int batch = 0;
+	int build = 0;
+	bool dedup = false;
+	int threads = 1;
+	bool findstats = false;
+	bool counters = false;
+	const char *load = NULL;
+	const char *write = NULL;
+	const char *edges = NULL;
+	const char *canon = NULL;
+	const char *cpuprofile = NULL;
+	const char *gen = NULL;
+	int genBlocks = 100000;
+	int genEdges = 0;
+	uint64_t seed = 1;
+	int chunk = 16<<20;
+	const char *engine = "havlak";
+	const char *format = "text";
+	int warmup = 1;
+	int iterations = 50;
+	int queries = 0;
+	int incremental = 0;
+	int churn = 0;
+	int regions = 0;
+	bool dominators = false;
+	bool check = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-check") == 0) {
+			check = true;
+			continue;
+		}
+		if (strcmp(argv[i], "-dominators") == 0) {
+			dominators = true;
+			continue;
+		}
+		if (strcmp(argv[i], "-recursivedfs") == 0) {
+			engine = "recursive";
+			continue;
+		}
+		if (strncmp(argv[i], "-engine=", 8) == 0) {
+			engine = argv[i]+8;
+			continue;
+		}
+		if (strncmp(argv[i], "-format=", 8) == 0) {
+			format = argv[i]+8;
+			continue;
+		}
+		if (strncmp(argv[i], "-warmup=", 8) == 0) {
+			warmup = atoi(argv[i]+8);
+			continue;
+		}
+		if (strncmp(argv[i], "-iterations=", 12) == 0) {
+			iterations = atoi(argv[i]+12);
+			continue;
+		}
+		if (strcmp(argv[i], "-findstats") == 0) {
+			findstats = true;
+			continue;
+		}
+		if (strcmp(argv[i], "-counters") == 0) {
+			counters = true;
+			findstats = true;
+			continue;
+		}
+		if (strncmp(argv[i], "-batch=", 7) == 0) {
+			batch = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-build=", 7) == 0) {
+			build = atoi(argv[i]+7);
+			continue;
+		}
+		if (strcmp(argv[i], "-dedup") == 0) {
+			dedup = true;
+			continue;
+		}
+		if (strncmp(argv[i], "-canon=", 7) == 0) {
+			canon = argv[i]+7;
+			continue;
+		}
+		if (strncmp(argv[i], "-cpuprofile=", 12) == 0) {
+			cpuprofile = argv[i]+12;
+			continue;
+		}
+		if (strncmp(argv[i], "-edges=", 7) == 0) {
+			edges = argv[i]+7;
+			continue;
+		}
+		if (strncmp(argv[i], "-chunk=", 7) == 0) {
+			chunk = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-churn=", 7) == 0) {
+			churn = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-incremental=", 13) == 0) {
+			incremental = atoi(argv[i]+13);
+			continue;
+		}
+		if (strncmp(argv[i], "-regions=", 9) == 0) {
+			regions = atoi(argv[i]+9);
+			continue;
+		}
+		if (strncmp(argv[i], "-queries=", 9) == 0) {
+			queries = atoi(argv[i]+9);
+			continue;
+		}
+		if (strncmp(argv[i], "-gen=", 5) == 0) {
+			gen = argv[i]+5;
+			continue;
+		}
+		if (strncmp(argv[i], "-blocks=", 8) == 0) {
+			genBlocks = atoi(argv[i]+8);
+			continue;
+		}
+		if (strncmp(argv[i], "-nedge=", 7) == 0) {
+			genEdges = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-seed=", 6) == 0) {
+			seed = strtoull(argv[i]+6, NULL, 0);
+			continue;
+		}
+		if (strncmp(argv[i], "-load=", 6) == 0) {
+			load = argv[i]+6;
+			continue;
+		}
+		if (strncmp(argv[i], "-write=", 7) == 0) {
+			write = argv[i]+7;
+			continue;
+		}
+		if (strncmp(argv[i], "-threads=", 9) == 0) {
+			threads = atoi(argv[i]+9);
+			continue;
+		}
+		if (strncmp(argv[i], "-deeploop=", 10) == 0) {
+			deep = atoi(argv[i]+10);
+			continue;
+		}
+		if (strncmp(argv[i], "-wideloop=", 10) == 0) {
+			wide = atoi(argv[i]+10);
+			continue;
+		}
+		fprintf(stderr, "usage: havlak6cc [-batch=n] [-blocks=n] [-build=copies] [-canon=file] [-check] [-chunk=bytes] [-churn=n] [-counters] [-cpuprofile=file] [-dedup] [-deeploop=depth] [-dominators] [-edges=file] [-engine=havlak|recursive|natural] [-findstats] [-format=text|json|csv] [-gen=family] [-incremental=batch] [-iterations=n] [-load=file] [-nedge=n] [-queries=n] [-recursivedfs] [-regions=n] [-seed=n] [-threads=n] [-warmup=n] [-wideloop=width] [-write=file]\n");
+		fprintf(stderr, "families: %s\n", GenFamilies);
+		return 2;
+	}
+	if (strcmp(engine, "havlak") != 0 && strcmp(engine, "recursive") != 0 && strcmp(engine, "natural") != 0) {
+		fprintf(stderr, "unknown engine %s; want havlak, recursive or natural\n", engine);
+		return 2;
+	}
+	if (!BenchFormatOK(format)) {
+		fprintf(stderr, "unknown format %s; want text, json or csv\n", format);
+		return 2;
+	}
+	if (threads < 1)
+		threads = 1;
+	if (chunk < 1) {
+		fprintf(stderr, "bad chunk size %d; want at least 1 byte\n", chunk);
+		return 2;
+	}
+	if (iterations < 1)
+		iterations = 1;
+	FILE *log = strcmp(format, "text") == 0 ? stdout : stderr;
+
+	if (cpuprofile != NULL) {
+		if (!StartCPUProfile(cpuprofile))
+			return 1;
+		atexit([]() { StopCPUProfile(); });
+	}
+
+	if (batch > 0) {
+		BenchBatch(batch, threads);
+		return 0;
+	}
+	if (build > 0) {
+		BenchBuild(build, threads, dedup, write);
+		return 0;
+	}
+	if (edges != NULL) {
+		ReadEdges(edges, threads, chunk);
+		return 0;
+	}
+	
+	FrozenCFG *g = new FrozenCFG;
+	char graph[256];
+	if (load != NULL) {
+		snprintf(graph, sizeof graph, "load:%s", load);
+		double t0 = now();
+		if (!g->Load(load, check))
+			return 1;
+		fprintf(log, "load: %d blocks, %d edges: %.3fs\n", g->nblock, g->nedge, now() - t0);
+	} else if (gen != NULL) {
+		vector<int> src, dst;
+		int n = GenCFG(gen, genBlocks, genEdges, seed, &src, &dst);
+		if (n < 0) {
+			fprintf(stderr, "unknown family %s; want one of %s\n", gen, GenFamilies);
+			return 2;
+		}
+		g->Build(n, src.data(), dst.data(), src.size(), threads, false);
+		snprintf(graph, sizeof graph, "gen:%s:%d:%d:%llu", gen, g->nblock, g->nedge, (unsigned long long)seed);
+		fprintf(log, "gen: %s, %d blocks, %d edges, seed %llu\n", gen, g->nblock, g->nedge, (unsigned long long)seed);
+	} else {
+		CFG *cfg;
+		if (wide > 0) {
+			cfg = BuildWideGraph(wide);
+			snprintf(graph, sizeof graph, "wideloop:%d", wide);
+		} else if (deep > 0) {
+			cfg = BuildDeepGraph(deep);
+			snprintf(graph, sizeof graph, "deeploop:%d", deep);
+		} else {
+			cfg = BuildGraph();
+			snprintf(graph, sizeof graph, "default");
+		}
+		g->Freeze(cfg);
+		delete cfg;
+	}
+	if (write != NULL && !g->Write(write))
+		return 1;
+	if (incremental > 0) {
+		BenchIncremental(g, graph, incremental, iterations, seed, log);
+		delete g;
+		return 0;
+	}
+	if (churn > 0) {
+		BenchChurn(g, graph, churn, seed, log);
+		delete g;
+		return 0;
+	}
+	if (regions > 0) {
+		BenchRegions(g, graph, engine, regions, warmup, iterations, format, seed, log);
+		delete g;
+		return 0;
 	}
 
-	printf("# of loops: %d (including 1 artificial root node)\n", (int)lsg.loop.size());
-	lsg.CalculateNesting();
+	LoopGraph *lsg = BenchLoops(g, graph, engine, warmup, iterations, threads, format, findstats, counters);
+	if (canon != NULL && !lsg->WriteCanon(canon))
+		return 1;
+	if (queries > 0)
+		BenchQueries(lsg, g->nblock, queries, seed, log);
+	if (dominators)
+		BenchDominators(g, graph, warmup, iterations, format, 100, seed);
+	delete lsg;
 }
@@ -0,0 +1,355 @@
+// Havlakdiff runs several loop finders on the same graphs and
+// checks that they find the same loop forests.
+//
+// Each engine is a command line, run by the shell with
+//
+//	-load=graph -canon=out -format=csv -warmup=0 -iterations=n
+//
+// appended, so any program that reads CFG files (cfgfile.h), writes
+// canonical forests (canon.h) and reports benchmark results in CSV
+// (bench.h) can take part: havlak1cc, havlak6cc with any -engine,
+// and future engines alike. On each graph the first engine that
+// succeeds is the reference; every other engine's forest must
+// match it exactly.
+//
+// The graphs are either one loaded file or count generated ones
+// (cfggen.h), with seeds seed, seed+1, ... and sizes drawn at
+// random up to -blocks, so that small corner cases are covered
+// too. A graph that makes engines disagree is saved as
+// havlakdiff-<family>-<seed>.cfg for reproducing the failure.
+//
+// At the end havlakdiff reports, for each engine, its total time
+// (the sum of its median iteration times) relative to the first
+// engine, and its peak resident memory over all runs.
+//
+//	make havlak1cc havlak6cc havlakdiffcc
+//	./havlakdiffcc -gen=all -count=1000
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "cfgfile.h"
+#include "cfggen.h"
+
+using namespace std;
+
+struct Engine {
+	string cmd;
+	double seconds;	// total of median iteration times
+	long maxrss;	// peak resident memory, kB
+	int failed;	// graphs where the engine failed or disagreed
+};
+
+// readFile returns the contents of file, or "" if it cannot be read.
+
+string readFile(const char *file) {
+	string s;
+	FILE *f = fopen(file, "r");
+	if (f == NULL)
+		return s;
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+		s.append(buf, n);
+	fclose(f);
+	return s;
+}
+
+// writeFile writes s to file, reporting errors itself.
+
+bool writeFile(const char *file, const string &s) {
+	FILE *f = fopen(file, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return false;
+	}
+	fwrite(s.data(), 1, s.size(), f);
+	int err = ferror(f);
+	if (fclose(f) != 0 || err) {
+		fprintf(stderr, "%s: write error\n", file);
+		return false;
+	}
+	return true;
+}
+
+// removeEntry removes one file or empty directory, for nftw.
+
+int removeEntry(const char *path, const struct stat*, int, struct FTW*) {
+	return remove(path);
+}
+
+// removeAll removes dir and everything in it.
+
+void removeAll(const char *dir) {
+	nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// writeGraph writes the graph with edges src[i] -> dst[i] to file,
+// keeping the edges in order in each block's lists.
+
+bool writeGraph(const char *file, int nblock, const vector<int> &src, const vector<int> &dst) {
+	int nedge = src.size();
+	vector<int> inOff(nblock+1), outOff(nblock+1), in(nedge), out(nedge);
+	for (int i = 0; i < nedge; i++) {
+		inOff[dst[i]+1]++;
+		outOff[src[i]+1]++;
+	}
+	for (int b = 0; b < nblock; b++) {
+		inOff[b+1] += inOff[b];
+		outOff[b+1] += outOff[b];
+	}
+	vector<int> inPos(inOff.begin(), inOff.end()-1), outPos(outOff.begin(), outOff.end()-1);
+	for (int i = 0; i < nedge; i++) {
+		in[inPos[dst[i]]++] = src[i];
+		out[outPos[src[i]]++] = dst[i];
+	}
+	return WriteCFGFile(file, nblock, nedge, inOff.data(), in.data(), outOff.data(), out.data());
+}
+
+// quote returns s quoted for the shell.
+
+string quote(const string &s) {
+	string q = "'";
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '\'')
+			q += "'\\''";
+		else
+			q += s[i];
+	}
+	return q + "'";
+}
+
+// run runs engine e on graph, writing its forest to canon,
+// and adds its time and memory to e's totals. The engine's
+// output goes to out, and its errors to out.err.
+// It reports failures itself and returns false.
+
+bool run(Engine *e, const char *graph, const char *canon, const char *out, int iterations) {
+	string cmd = e->cmd + " -load=" + quote(graph) + " -canon=" + quote(canon) +
+		" -format=csv -warmup=0 -iterations=" + to_string(iterations) +
+		" >" + quote(out) + " 2>" + quote(string(out) + ".err");
+	unlink(canon);
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+		return false;
+	}
+	if (pid == 0) {
+		execl("/bin/sh", "sh", "-c", cmd.c_str(), (char*)NULL);
+		_exit(127);
+	}
+	int status;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		fprintf(stderr, "wait: %s\n", strerror(errno));
+		return false;
+	}
+	if (ru.ru_maxrss > e->maxrss)
+		e->maxrss = ru.ru_maxrss;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		string err = readFile((string(out) + ".err").c_str());
+		fprintf(stderr, "%s: failed (status %#x)\n%s", cmd.c_str(), status, err.c_str());
+		return false;
+	}
+
+	// The median is the 11th field of the CSV data line.
+	string csv = readFile(out);
+	size_t p = csv.find('\n');
+	if (p == string::npos) {
+		fprintf(stderr, "%s: no benchmark output\n", cmd.c_str());
+		return false;
+	}
+	p++;
+	for (int i = 0; i < 10 && p != string::npos; i++) {
+		p = csv.find(',', p);
+		if (p != string::npos)
+			p++;
+	}
+	if (p == string::npos) {
+		fprintf(stderr, "%s: bad benchmark output\n", cmd.c_str());
+		return false;
+	}
+	e->seconds += atof(csv.c_str() + p);
+	return true;
+}
+
+// firstDiff returns the first line where a and b differ.
+
+void firstDiff(const string &a, const string &b, string *la, string *lb) {
+	size_t i = 0;
+	while (i < a.size() && i < b.size() && a[i] == b[i])
+		i++;
+	size_t start = a.rfind('\n', i == 0 ? 0 : i-1);
+	start = start == string::npos || i == 0 ? 0 : start+1;
+	*la = a.substr(start, a.find('\n', start) - start);
+	*lb = b.substr(start, b.find('\n', start) - start);
+}
+
+int main(int argc, char **argv) {
+	vector<Engine> engine;
+	const char *gen = "all";
+	const char *load = NULL;
+	int blocks = 1000;
+	int nedge = 0;
+	uint64_t seed = 1;
+	int count = 100;
+	int iterations = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "-engine=", 8) == 0) {
+			Engine e = {argv[i]+8, 0, 0, 0};
+			engine.push_back(e);
+			continue;
+		}
+		if (strncmp(argv[i], "-gen=", 5) == 0) {
+			gen = argv[i]+5;
+			continue;
+		}
+		if (strncmp(argv[i], "-load=", 6) == 0) {
+			load = argv[i]+6;
+			continue;
+		}
+		if (strncmp(argv[i], "-blocks=", 8) == 0) {
+			blocks = atoi(argv[i]+8);
+			continue;
+		}
+		if (strncmp(argv[i], "-nedge=", 7) == 0) {
+			nedge = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-seed=", 6) == 0) {
+			seed = strtoull(argv[i]+6, NULL, 0);
+			continue;
+		}
+		if (strncmp(argv[i], "-count=", 7) == 0) {
+			count = atoi(argv[i]+7);
+			continue;
+		}
+		if (strncmp(argv[i], "-iterations=", 12) == 0) {
+			iterations = atoi(argv[i]+12);
+			continue;
+		}
+		fprintf(stderr, "usage: havlakdiffcc [-blocks=n] [-count=n] [-engine=cmd]... [-gen=family|all] [-iterations=n] [-load=file] [-nedge=n] [-seed=n]\n");
+		fprintf(stderr, "families: %s\n", GenFamilies);
+		return 2;
+	}
+	if (engine.empty()) {
+		const char *def[] = {"./havlak1cc", "./havlak6cc", "./havlak6cc -engine=recursive", "./havlak6cc -engine=natural"};
+		for (int i = 0; i < 4; i++) {
+			Engine e = {def[i], 0, 0, 0};
+			engine.push_back(e);
+		}
+	}
+	if (engine.size() < 2) {
+		fprintf(stderr, "need at least two engines to compare\n");
+		return 2;
+	}
+	if (load != NULL)
+		count = 1;
+
+	char dir[] = "/tmp/havlakdiff.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+	string graph = load != NULL ? string(load) : string(dir) + "/graph.cfg";
+	string out = string(dir) + "/out";
+	vector<string> canon(engine.size());
+	for (size_t i = 0; i < engine.size(); i++) {
+		char buf[32];
+		snprintf(buf, sizeof buf, "/canon%zu", i);
+		canon[i] = dir + string(buf);
+	}
+
+	// Families in the order -gen=all cycles through them.
+	vector<string> family;
+	if (strcmp(gen, "all") == 0) {
+		string s = GenFamilies;
+		for (size_t p = 0; p < s.size(); ) {
+			size_t q = s.find(", ", p);
+			if (q == string::npos)
+				q = s.size();
+			family.push_back(s.substr(p, q-p));
+			p = q + 2;
+		}
+	} else {
+		family.push_back(gen);
+	}
+
+	int nfail = 0;
+	long long nblock = 0;
+	for (int i = 0; i < count; i++) {
+		uint64_t s = seed + i;
+		const char *fam = family[i % family.size()].c_str();
+		if (load == NULL) {
+			GenRand r(s);
+			int n = 1 + r.Intn(blocks);
+			vector<int> src, dst;
+			n = GenCFG(fam, n, nedge, s, &src, &dst);
+			if (n < 0) {
+				fprintf(stderr, "unknown family %s; want one of %s\n", fam, GenFamilies);
+				removeAll(dir);
+				return 2;
+			}
+			if (!writeGraph(graph.c_str(), n, src, dst)) {
+				removeAll(dir);
+				return 1;
+			}
+			nblock += n;
+		}
+
+		// An engine that fails is blamed for that alone,
+		// and the next one to succeed becomes the reference.
+		bool ok = true;
+		string ref;
+		int refEngine = -1;
+		for (size_t j = 0; j < engine.size(); j++) {
+			if (!run(&engine[j], graph.c_str(), canon[j].c_str(), out.c_str(), iterations)) {
+				engine[j].failed++;
+				ok = false;
+				continue;
+			}
+			string c = readFile(canon[j].c_str());
+			if (refEngine < 0) {
+				ref = c;
+				refEngine = j;
+			} else if (c != ref) {
+				string la, lb;
+				firstDiff(ref, c, &la, &lb);
+				fprintf(stderr, "%s seed %llu: %s and %s differ:\n\t%s\n\t%s\n",
+					load ? load : fam, (unsigned long long)s,
+					engine[refEngine].cmd.c_str(), engine[j].cmd.c_str(), la.c_str(), lb.c_str());
+				engine[j].failed++;
+				ok = false;
+			}
+		}
+		if (!ok) {
+			nfail++;
+			if (load == NULL) {
+				string save = string("havlakdiff-") + fam + "-" + to_string(s) + ".cfg";
+				if (writeFile(save.c_str(), readFile(graph.c_str())))
+					fprintf(stderr, "saved graph as %s\n", save.c_str());
+			}
+		}
+	}
+
+	printf("%d graphs, %lld blocks, %d failed\n", count, nblock, nfail);
+	for (size_t j = 0; j < engine.size(); j++) {
+		Engine *e = &engine[j];
+		printf("%-40s %9.3fs %6.2fx %8ld kB peak %5d failed\n",
+			e->cmd.c_str(), e->seconds,
+			engine[0].seconds > 0 ? e->seconds / engine[0].seconds : 0.0,
+			e->maxrss, e->failed);
+	}
+
+	removeAll(dir);
+	return nfail > 0;
+}
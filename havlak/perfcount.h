@@ -0,0 +1,118 @@
+// Hardware performance counters, shared by the C++ loop finders.
+//
+// PerfCounters opens one perf_event_open counter per event for the
+// calling thread, user mode only. Each event is its own group, so
+// the kernel multiplexes them when there are more events than
+// hardware counters, and Read scales the counts by the fraction of
+// time each was actually running.
+//
+// Counters are often unavailable: in containers and virtual machines
+// without a virtual PMU, or when perf_event_paranoid forbids them.
+// Open then returns false and Read returns zeros, so callers need
+// not check; events that cannot be opened singly read as zero too.
+
+#ifndef HAVLAK_PERFCOUNT_H
+#define HAVLAK_PERFCOUNT_H
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PerfCounters {
+	enum {
+		Cycles,
+		Instructions,
+		L1DMiss,
+		LLCMiss,
+		DTLBMiss,
+		BranchMiss,
+		NCounter,
+	};
+
+	int fd[NCounter];
+	int nopen;
+
+	PerfCounters() : nopen(0) {
+		for (int i = 0; i < NCounter; i++)
+			fd[i] = -1;
+	}
+	~PerfCounters() {
+		for (int i = 0; i < NCounter; i++)
+			if (fd[i] >= 0)
+				close(fd[i]);
+	}
+
+	bool Open();
+	void Read(uint64_t *v);
+
+	static const char *const name[NCounter];
+};
+
+inline const char *const PerfCounters::name[PerfCounters::NCounter] = {
+	"cycles", "instructions", "l1d-misses", "llc-misses", "dtlb-misses", "branch-misses",
+};
+
+inline uint64_t perfCache(int cache, int op, int result) {
+	return cache | op<<8 | result<<16;
+}
+
+// Open opens the counters for the calling thread and reports
+// whether any are available.
+
+inline bool PerfCounters::Open() {
+	static const struct {
+		uint32_t type;
+		uint64_t config;
+	} event[NCounter] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HW_CACHE, perfCache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{PERF_TYPE_HW_CACHE, perfCache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	};
+	for (int i = 0; i < NCounter; i++) {
+		if (this->fd[i] >= 0)
+			continue;
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = event[i].type;
+		attr.config = event[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		this->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (this->fd[i] >= 0)
+			this->nopen++;
+	}
+	return this->nopen > 0;
+}
+
+// Read sets v[i] to the current count of counter i,
+// scaled for multiplexing, or 0 if it is unavailable.
+
+inline void PerfCounters::Read(uint64_t *v) {
+	for (int i = 0; i < NCounter; i++) {
+		uint64_t r[3];	// value, time enabled, time running
+		v[i] = 0;
+		if (this->fd[i] < 0 || read(this->fd[i], r, sizeof r) != sizeof r || r[2] == 0)
+			continue;
+		v[i] = r[2] < r[1] ? (uint64_t)((double)r[0] * r[1] / r[2]) : r[0];
+	}
+}
+
+// ThreadCounters returns the calling thread's counters, opening
+// them on first use, or NULL if none are available.
+
+inline PerfCounters *ThreadCounters() {
+	static thread_local PerfCounters pc;
+	static thread_local int state;	// 0 unopened, 1 open, -1 unavailable
+	if (state == 0)
+		state = pc.Open() ? 1 : -1;
+	return state > 0 ? &pc : NULL;
+}
+
+#endif  // HAVLAK_PERFCOUNT_H
@@ -0,0 +1,397 @@
+// CPU profiling for the C++ programs, so that they can be run with
+// -cpuprofile=file like the Go ones and the output examined with
+// pprof. (The copy built into the go command symbolizes only Go
+// binaries; use the standalone pprof or gperftools' pprof.)
+//
+// A SIGPROF timer interrupts the process hz times per second of CPU
+// time, and the handler records the interrupted call stack in a
+// fixed table, counting repeats of the same stack. StopCPUProfile
+// writes the table in the legacy binary profile format: a header,
+// one record per distinct stack, a trailer, and a copy of
+// /proc/self/maps for symbolization.
+
+#ifndef HAVLAK_PROFILE_H
+#define HAVLAK_PROFILE_H
+
+#include <errno.h>
+#include <execinfo.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <atomic>
+
+struct CPUProfile {
+	enum {
+		MaxDepth = 64,
+		NStack = 1<<14,	// distinct stacks kept; more are dropped
+		Skip = 2,	// handler and signal trampoline frames
+	};
+	struct Stack {
+		uintptr_t count;
+		uintptr_t depth;
+		void *pc[MaxDepth];
+	};
+
+	FILE *f;
+	int hz;
+	Stack *stack;
+	int nstack;
+	std::atomic<int64_t> dropped;
+	std::atomic_flag busy;
+};
+
+inline CPUProfile cpuProfile;
+
+// cpuProfileSignal records one sample. It runs in signal context,
+// so it allocates nothing and takes no locks it could wait on:
+// a sample arriving while another thread holds the table is dropped.
+
+inline void cpuProfileSignal(int sig) {
+	CPUProfile *p = &cpuProfile;
+	int err = errno;
+	void *pc[CPUProfile::MaxDepth + CPUProfile::Skip];
+	int n = backtrace(pc, CPUProfile::MaxDepth + CPUProfile::Skip) - CPUProfile::Skip;
+	if (n <= 0 || p->busy.test_and_set(std::memory_order_acquire)) {
+		p->dropped++;
+		errno = err;
+		return;
+	}
+	uintptr_t h = n;
+	for (int i = 0; i < n; i++)
+		h = (h ^ (uintptr_t)pc[CPUProfile::Skip+i]) * 1099511628211ULL;
+	for (int probe = 0; probe < CPUProfile::NStack; probe++) {
+		CPUProfile::Stack *s = &p->stack[(h + probe) & (CPUProfile::NStack-1)];
+		if (s->count == 0) {
+			s->count = 1;
+			s->depth = n;
+			memcpy(s->pc, pc + CPUProfile::Skip, n * sizeof pc[0]);
+			p->nstack++;
+			break;
+		}
+		if (s->depth == (uintptr_t)n && memcmp(s->pc, pc + CPUProfile::Skip, n * sizeof pc[0]) == 0) {
+			s->count++;
+			break;
+		}
+		if (probe == CPUProfile::NStack-1)
+			p->dropped++;
+	}
+	p->busy.clear(std::memory_order_release);
+	errno = err;
+}
+
+// StartCPUProfile starts sampling, to be written to file by
+// StopCPUProfile. It reports errors itself and returns false.
+
+inline bool StartCPUProfile(const char *file, int hz = 100) {
+	CPUProfile *p = &cpuProfile;
+	p->f = fopen(file, "wb");
+	if (p->f == NULL) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return false;
+	}
+	p->hz = hz;
+	p->stack = new CPUProfile::Stack[CPUProfile::NStack]();
+	p->nstack = 0;
+	p->dropped = 0;
+	p->busy.clear();
+
+	// The first backtrace loads the unwinder, which may allocate;
+	// do it now rather than in the handler.
+	void *pc[1];
+	backtrace(pc, 1);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = cpuProfileSignal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, NULL);
+
+	struct itimerval it;
+	it.it_interval.tv_sec = 0;
+	it.it_interval.tv_usec = 1000000 / hz;
+	it.it_value = it.it_interval;
+	setitimer(ITIMER_PROF, &it, NULL);
+	return true;
+}
+
+// StopCPUProfile stops sampling and writes the profile.
+
+inline bool StopCPUProfile() {
+	CPUProfile *p = &cpuProfile;
+	if (p->f == NULL)
+		return true;
+	struct itimerval it;
+	memset(&it, 0, sizeof it);
+	setitimer(ITIMER_PROF, &it, NULL);
+	signal(SIGPROF, SIG_IGN);
+
+	FILE *f = p->f;
+	uintptr_t head[5] = {0, 3, 0, (uintptr_t)(1000000 / p->hz), 0};
+	fwrite(head, sizeof head, 1, f);
+	for (int i = 0; i < CPUProfile::NStack; i++) {
+		CPUProfile::Stack *s = &p->stack[i];
+		if (s->count > 0)
+			fwrite(s, sizeof(uintptr_t), 2 + s->depth, f);
+	}
+	uintptr_t tail[3] = {0, 1, 0};
+	fwrite(tail, sizeof tail, 1, f);
+
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps != NULL) {
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof buf, maps)) > 0)
+			fwrite(buf, 1, n, f);
+		fclose(maps);
+	}
+	if (p->dropped > 0)
+		fprintf(stderr, "cpuprofile: %lld samples dropped\n", (long long)p->dropped.load());
+
+	bool ok = !ferror(f);
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "cpuprofile: write error\n");
+	p->f = NULL;
+	delete[] p->stack;
+	p->stack = NULL;
+	return ok;
+}
+
+// Heap profiling, for -memprofile=file.
+//
+// A program that replaces operator new and delete calls
+// MemProfileAlloc and MemProfileFree from them. On average one
+// allocation per rate bytes is sampled: its call stack is recorded
+// with counts of the sampled allocations and bytes, and the pointer
+// is remembered so that freeing it can be charged back to the same
+// stack. StopMemProfile writes the legacy text heap profile format
+// (as written by the Go runtime) followed by /proc/self/maps.
+
+struct MemProfile {
+	enum {
+		MaxDepth = 64,
+		NStack = 1<<14,	// distinct stacks kept; more are dropped
+		NLive = 1<<18,	// sampled blocks tracked until freed
+		Skip = 1,	// MemProfileAlloc's own frame
+	};
+	struct Stack {
+		int64_t allocs;
+		int64_t allocBytes;
+		int64_t frees;
+		int64_t freeBytes;
+		int depth;
+		void *pc[MaxDepth];
+	};
+	struct Live {
+		void *p;	// NULL if empty, Dead if freed
+		int64_t size;
+		int stack;
+	};
+
+	const char *file;
+	int64_t rate;
+	Stack *stack;
+	Live *live;
+	int nlive;
+	int64_t dropped;
+	std::atomic_flag busy;
+	std::atomic<bool> on;
+};
+
+inline MemProfile memProfile;
+inline thread_local int64_t memProfileNext;	// bytes until next sample
+inline thread_local uint64_t memProfileRand = 0x9e3779b97f4a7c15ULL;
+inline thread_local bool memProfileIn;	// recursion guard
+
+inline void *const memProfileDead = (void*)1;
+
+// memProfileGap picks the number of bytes to the next sample,
+// exponentially distributed with mean rate so that sampling
+// does not fall into step with any allocation pattern.
+
+inline int64_t memProfileGap(int64_t rate) {
+	uint64_t x = memProfileRand;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	memProfileRand = x;
+	double u = ((x >> 11) + 0.5) / 9007199254740992.0;
+	return (int64_t)(-log(u) * rate) + 1;
+}
+
+inline uint32_t memProfileHash(void *p) {
+	return (uint32_t)(((uintptr_t)p >> 4) * 0x9e3779b97f4a7c15ULL >> 40);
+}
+
+inline void memProfileLock() {
+	while (memProfile.busy.test_and_set(std::memory_order_acquire))
+		;
+}
+
+inline void memProfileUnlock() {
+	memProfile.busy.clear(std::memory_order_release);
+}
+
+__attribute__((noinline)) inline void MemProfileAlloc(void *p, size_t size) {
+	MemProfile *m = &memProfile;
+	if (!m->on.load(std::memory_order_relaxed) || memProfileIn)
+		return;
+	memProfileNext -= size;
+	if (memProfileNext > 0)
+		return;
+	memProfileNext = memProfileGap(m->rate);
+
+	memProfileIn = true;
+	void *pc[MemProfile::MaxDepth + MemProfile::Skip];
+	int n = backtrace(pc, MemProfile::MaxDepth + MemProfile::Skip) - MemProfile::Skip;
+	memProfileIn = false;
+	if (n <= 0)
+		return;
+	uintptr_t h = n;
+	for (int i = 0; i < n; i++)
+		h = (h ^ (uintptr_t)pc[MemProfile::Skip+i]) * 1099511628211ULL;
+
+	memProfileLock();
+	int si = -1;
+	for (int probe = 0; probe < MemProfile::NStack; probe++) {
+		int i = (h + probe) & (MemProfile::NStack-1);
+		MemProfile::Stack *s = &m->stack[i];
+		if (s->depth == 0) {
+			s->depth = n;
+			memcpy(s->pc, pc + MemProfile::Skip, n * sizeof pc[0]);
+		} else if (s->depth != n || memcmp(s->pc, pc + MemProfile::Skip, n * sizeof pc[0]) != 0) {
+			continue;
+		}
+		s->allocs++;
+		s->allocBytes += size;
+		si = i;
+		break;
+	}
+	if (si >= 0 && m->nlive < MemProfile::NLive/2) {
+		for (uint32_t i = memProfileHash(p); ; i++) {
+			MemProfile::Live *l = &m->live[i & (MemProfile::NLive-1)];
+			if (l->p == NULL || l->p == memProfileDead) {
+				if (l->p == NULL)
+					m->nlive++;
+				l->p = p;
+				l->size = size;
+				l->stack = si;
+				break;
+			}
+		}
+	} else {
+		m->dropped++;
+	}
+	memProfileUnlock();
+}
+
+inline void MemProfileFree(void *p) {
+	MemProfile *m = &memProfile;
+	if (p == NULL || !m->on.load(std::memory_order_relaxed))
+		return;
+	memProfileLock();
+	for (uint32_t i = memProfileHash(p); ; i++) {
+		MemProfile::Live *l = &m->live[i & (MemProfile::NLive-1)];
+		if (l->p == NULL)
+			break;
+		if (l->p == p) {
+			MemProfile::Stack *s = &m->stack[l->stack];
+			s->frees++;
+			s->freeBytes += l->size;
+			l->p = memProfileDead;
+			break;
+		}
+	}
+	memProfileUnlock();
+}
+
+// StartMemProfile starts sampling one allocation per rate bytes,
+// to be written to file by StopMemProfile.
+
+inline void StartMemProfile(const char *file, int64_t rate = 512*1024) {
+	MemProfile *m = &memProfile;
+	m->file = file;
+	m->rate = rate;
+	m->stack = (MemProfile::Stack*)calloc(MemProfile::NStack, sizeof m->stack[0]);
+	m->live = (MemProfile::Live*)calloc(MemProfile::NLive, sizeof m->live[0]);
+	m->nlive = 0;
+	m->dropped = 0;
+	m->busy.clear();
+	memProfileNext = memProfileGap(rate);
+
+	void *pc[1];
+	backtrace(pc, 1);
+	m->on = true;
+}
+
+// StopMemProfile stops sampling and writes the profile.
+// It reports errors itself and returns false.
+
+inline bool StopMemProfile() {
+	MemProfile *m = &memProfile;
+	if (!m->on)
+		return true;
+	m->on = false;
+	memProfileLock();
+	FILE *f = fopen(m->file, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", m->file, strerror(errno));
+		memProfileUnlock();
+		return false;
+	}
+
+	int64_t tot[4] = {0, 0, 0, 0};
+	for (int i = 0; i < MemProfile::NStack; i++) {
+		MemProfile::Stack *s = &m->stack[i];
+		tot[0] += s->allocs - s->frees;
+		tot[1] += s->allocBytes - s->freeBytes;
+		tot[2] += s->allocs;
+		tot[3] += s->allocBytes;
+	}
+	fprintf(f, "heap profile: %lld: %lld [%lld: %lld] @ heap/%lld\n",
+		(long long)tot[0], (long long)tot[1], (long long)tot[2], (long long)tot[3],
+		(long long)(2 * m->rate));
+	for (int i = 0; i < MemProfile::NStack; i++) {
+		MemProfile::Stack *s = &m->stack[i];
+		if (s->allocs == 0)
+			continue;
+		fprintf(f, "%lld: %lld [%lld: %lld] @",
+			(long long)(s->allocs - s->frees), (long long)(s->allocBytes - s->freeBytes),
+			(long long)s->allocs, (long long)s->allocBytes);
+		for (int j = 0; j < s->depth; j++)
+			fprintf(f, " %p", s->pc[j]);
+		fprintf(f, "\n");
+	}
+
+	fprintf(f, "\nMAPPED_LIBRARIES:\n");
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps != NULL) {
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof buf, maps)) > 0)
+			fwrite(buf, 1, n, f);
+		fclose(maps);
+	}
+	if (m->dropped > 0)
+		fprintf(stderr, "memprofile: %lld samples not tracked\n", (long long)m->dropped);
+
+	bool ok = !ferror(f);
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "memprofile: write error\n");
+	free(m->stack);
+	free(m->live);
+	m->stack = NULL;
+	m->live = NULL;
+	memProfileUnlock();
+	return ok;
+}
+
+#endif  // HAVLAK_PROFILE_H
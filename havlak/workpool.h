@@ -0,0 +1,87 @@
+// Work-stealing parallel loop, shared by the C++ loop finders.
+
+#ifndef HAVLAK_WORKPOOL_H
+#define HAVLAK_WORKPOOL_H
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A range [lo, hi) of task indices owned by one worker.
+// The owner takes tasks from the bottom of its range;
+// a thief takes the top half of what is left.
+struct WorkRange {
+	std::mutex mu;
+	int lo;
+	int hi;
+};
+
+// Steal moves half of the remaining tasks of some other worker
+// into range[w], reporting whether there was anything to steal.
+inline bool Steal(std::vector<WorkRange> &range, int w) {
+	int n = range.size();
+	for (int i = 1; i < n; i++) {
+		WorkRange *v = &range[(w+i) % n];
+		v->mu.lock();
+		int lo = v->lo;
+		int hi = v->hi;
+		int mid = lo + (hi-lo)/2;
+		if (lo < hi)
+			v->hi = mid;
+		v->mu.unlock();
+		if (lo < hi) {
+			WorkRange *r = &range[w];
+			r->mu.lock();
+			r->lo = mid;
+			r->hi = hi;
+			r->mu.unlock();
+			return true;
+		}
+	}
+	return false;
+}
+
+// ParallelFor calls f(w, i) for every i in [0, n) using nthread
+// threads, one of them the caller. w, in [0, nthread), identifies
+// the worker making the call, so that f can keep per-worker state.
+// Each worker starts with an equal share of the indices and steals
+// from the others once its own share runs out, which keeps all the
+// workers busy even when task costs differ wildly.
+template<class F>
+void ParallelFor(int n, int nthread, F f) {
+	if (nthread > n)
+		nthread = n;
+	if (nthread < 1)
+		nthread = 1;
+
+	std::vector<WorkRange> range(nthread);
+	for (int w = 0; w < nthread; w++) {
+		range[w].lo = (long long)n * w / nthread;
+		range[w].hi = (long long)n * (w+1) / nthread;
+	}
+
+	auto work = [&](int w) {
+		WorkRange *r = &range[w];
+		for (;;) {
+			r->mu.lock();
+			if (r->lo < r->hi) {
+				int i = r->lo++;
+				r->mu.unlock();
+				f(w, i);
+				continue;
+			}
+			r->mu.unlock();
+			if (!Steal(range, w))
+				return;
+		}
+	};
+
+	std::vector<std::thread> thread;
+	for (int w = 1; w < nthread; w++)
+		thread.push_back(std::thread(work, w));
+	work(0);
+	for (size_t i = 0; i < thread.size(); i++)
+		thread[i].join();
+}
+
+#endif  // HAVLAK_WORKPOOL_H